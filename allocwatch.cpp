@@ -0,0 +1,98 @@
+#include "allocwatch.h"
+
+#ifdef AY2YM_ALLOC_CHECK
+
+#include <stdlib.h>
+#include <new>
+#if defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+
+static thread_local int watching = 0;
+static thread_local uint64_t counted = 0;
+
+static inline void note_allocation() {
+    if (watching) counted++;
+}
+
+#if defined(__GLIBC__)
+
+// Every allocation, operator new included, ends up here
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size) noexcept {
+    note_allocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept {
+    note_allocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) noexcept {
+    note_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+#elif defined(_MSC_VER) && defined(_DEBUG)
+
+// The debug CRT reports every allocation, operator new included
+static int alloc_hook(int type, void*, size_t, int, long, const unsigned char*, int) {
+    if (type == _HOOK_ALLOC || type == _HOOK_REALLOC) note_allocation();
+    return 1;
+}
+
+#else
+
+// The C runtime can't be hooked here, operator new can
+void* operator new(size_t size) {
+    note_allocation();
+    void* block = malloc(size ? size : 1);
+    if (!block) throw std::bad_alloc();
+    return block;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    note_allocation();
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void* block) noexcept {
+    free(block);
+}
+
+void operator delete[](void* block) noexcept {
+    free(block);
+}
+
+#endif
+
+void allocwatch_begin() {
+#if defined(_MSC_VER) && defined(_DEBUG)
+    static int hooked = 0;
+    if (!hooked) {
+        _CrtSetAllocHook(alloc_hook);
+        hooked = 1;
+    }
+#endif
+    counted = 0;
+    watching = 1;
+}
+
+uint64_t allocwatch_end() {
+    watching = 0;
+    return counted;
+}
+
+#endif
@@ -0,0 +1,28 @@
+/* allocwatch.h
+ * Test hook checking that the frame loop never touches the heap (builds
+ * with AY2YM_ALLOC_CHECK defined only).
+ *
+ * allocwatch_begin() and allocwatch_end() bracket a region on the calling
+ * thread and count the heap allocations made on that thread in between:
+ * malloc, calloc and realloc where the C runtime lets them be hooked (glibc,
+ * MSVC debug CRT) and operator new everywhere. Allocations of other threads
+ * (sinks, readers) are not counted.
+ *
+ * Without the define nothing here is compiled in.
+ */
+
+#ifndef __ALLOCWATCH_INCLUDED__
+#define __ALLOCWATCH_INCLUDED__
+
+#ifdef AY2YM_ALLOC_CHECK
+
+#include <stdint.h>
+
+void allocwatch_begin();
+
+// Allocations counted since allocwatch_begin()
+uint64_t allocwatch_end();
+
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_HEADER ((sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static uint8_t* chunk_data(ArenaChunk* chunk) {
+    return (uint8_t*)chunk + CHUNK_HEADER;
+}
+
+// Chunks come in power of two size classes, so a chunk made for one song
+// fits every later song of up to the same class
+static size_t chunk_class(size_t size) {
+    size_t chunk_size = ARENA_CHUNK_SIZE;
+    while (chunk_size < size) chunk_size *= 2;
+    return chunk_size;
+}
+
+static size_t round_up(size_t size) {
+    return size ? (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1) : ARENA_ALIGN;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = round_up(size);
+    ArenaChunk* chunk = arena->current;
+    if (chunk && chunk->size - chunk->used >= size) {
+        void* block = chunk_data(chunk) + chunk->used;
+        chunk->used += size;
+        return block;
+    }
+
+    // Move on to the first kept chunk big enough, or put a new one in front
+    // of the kept chunks
+    ArenaChunk** link = chunk ? &chunk->next : &arena->first;
+    ArenaChunk** fit = link;
+    while (*fit && (*fit)->size < size) fit = &(*fit)->next;
+    ArenaChunk* next = *fit;
+    if (next) {
+        if (fit != link) {
+            *fit = next->next;
+            next->next = *link;
+            *link = next;
+        }
+    }
+    else {
+        size_t chunk_size = chunk_class(size);
+        next = (ArenaChunk*)malloc(CHUNK_HEADER + chunk_size);
+        if (!next) return NULL;
+        arena->chunk_allocations++;
+        next->size = chunk_size;
+        next->next = *link;
+        *link = next;
+    }
+
+    next->used = size;
+    arena->current = next;
+    return chunk_data(next);
+}
+
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    ArenaChunk* chunk = arena->current;
+    if (ptr && chunk) {
+        size_t offset = (size_t)((uint8_t*)ptr - chunk_data(chunk));
+        int last = (uint8_t*)ptr >= chunk_data(chunk) && offset + round_up(old_size) == chunk->used;
+        if (last && offset + round_up(new_size) <= chunk->size) {
+            chunk->used = offset + round_up(new_size);
+            return ptr;
+        }
+    }
+
+    void* block = arena_alloc(arena, new_size);
+    if (block && ptr) memcpy(block, ptr, old_size < new_size ? old_size : new_size);
+    return block;
+}
+
+char* arena_strdup(Arena* arena, const char* text) {
+    size_t length = strlen(text) + 1;
+    char* copy = (char*)arena_alloc(arena, length);
+    if (copy) memcpy(copy, text, length);
+    return copy;
+}
+
+ArenaMark arena_mark(const Arena* arena) {
+    ArenaMark mark = { arena->current, arena->current ? arena->current->used : 0 };
+    return mark;
+}
+
+void arena_rewind(Arena* arena, ArenaMark mark) {
+    arena->current = mark.chunk;
+    if (mark.chunk) mark.chunk->used = mark.used;
+}
+
+void arena_reset(Arena* arena) {
+    arena->current = NULL;
+}
+
+void arena_release(Arena* arena) {
+    while (arena->first) {
+        ArenaChunk* next = arena->first->next;
+        free(arena->first);
+        arena->first = next;
+    }
+    arena->current = NULL;
+}
@@ -0,0 +1,70 @@
+/* arena.h
+ * Per-worker bump allocator for the memory a song needs.
+ *
+ * Allocations move a pointer through large chunks. Chunks are kept when
+ * the arena is reset or rewound to a mark, so once a worker has converted
+ * its largest song, the songs after it don't touch the heap at all, and
+ * workers never contend on the allocator. Nothing is freed individually:
+ * everything allocated after a mark goes at once when the arena is rewound
+ * to it. An arena belongs to one thread at a time.
+ *
+ * The audio sinks are the exception: their synth buffers and rendered
+ * segments belong to the render threads and come from the heap on every
+ * song (the threads themselves are kept, see sinks.h).
+ *
+ * Chunk sizes are powers of two from ARENA_CHUNK_SIZE up, and a block that
+ * doesn't fit the current chunk takes the first kept chunk big enough for
+ * it, so the kept chunks work as a pool of size classes shared by all the
+ * songs a worker converts.
+ */
+
+#ifndef __ARENA_INCLUDED__
+#define __ARENA_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_CHUNK_SIZE (256 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;              // usable bytes
+    size_t used;
+} ArenaChunk;
+
+// A position to rewind to; chunk is NULL for an empty arena
+typedef struct ArenaMark {
+    ArenaChunk* chunk;
+    size_t used;
+} ArenaMark;
+
+struct Arena;
+void arena_release(struct Arena* arena);
+
+typedef struct Arena {
+    ArenaChunk* first;
+    ArenaChunk* current;      // chunks after it are free for reuse
+    uint64_t chunk_allocations;   // heap allocations made so far
+
+    // Thread local arenas give their chunks back when the thread exits
+    ~Arena() { arena_release(this); }
+} Arena;
+
+// Returns NULL on allocation failure. Memory is aligned to ARENA_ALIGN.
+void* arena_alloc(Arena* arena, size_t size);
+
+// Resize the block at ptr (NULL for a new one). The last block allocated
+// grows in place while its chunk has room, anything else is copied.
+// Returns NULL on failure, leaving the old block as it was.
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+
+char* arena_strdup(Arena* arena, const char* text);
+
+ArenaMark arena_mark(const Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+
+// Make everything free again, keeping the chunks
+void arena_reset(Arena* arena);
+
+#endif
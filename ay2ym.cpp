@@ -3,14 +3,105 @@
 #include "ay2ym.h"
 #include "z80emu.h"
 #include "z80user.h"
-
-// Global AY2YM context and CPU state
-static AY2YM ctx;
-void* context = &ctx;
-
-static Z80_STATE cpu;
-
-MachineDetectionResult result;
+#include "sinks.h"
+#include "framecache.h"
+#include "logging.h"
+#include "hash.h"
+#include "snapshot.h"
+#include "ayindex.h"
+#include "batch.h"
+#include "manifest.h"
+#include "pack.h"
+#include "stats.h"
+#include "arena.h"
+#include "allocwatch.h"
+#include "bench.h"
+#include "aycorpus.h"
+#include "machine.h"
+#include "portscan.h"
+#include "players.h"
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <sys/stat.h>
+
+// AY2YM context and CPU state. Each thread works on its own file, so
+// everything describing the current file and song is thread local.
+static thread_local AY2YM ctx;
+static thread_local Z80_STATE cpu;
+
+static thread_local MachineDetectionResult result;
+
+thread_local const char* orig_file_name = NULL;
+thread_local const char* song_name = NULL;
+thread_local const char* author = NULL;
+
+// Requested output formats and the matching file names for the current song
+OutputFormat output_formats[MAX_OUTPUTS] = { OUTPUT_YM };
+int output_format_count = 1;
+static thread_local char* output_files[MAX_OUTPUTS];
+
+// Per-worker arenas: song_arena holds the names of the current file and
+// song (rewound to file_mark for every song), sink_arenas[k] everything the
+// sink for output k allocates. After the first few songs a worker converts
+// without touching the heap.
+static thread_local Arena song_arena;
+static thread_local ArenaMark file_mark;
+static thread_local Arena sink_arenas[MAX_OUTPUTS];
+
+// Pack output (--pack): sinks write to per-worker scratch files that are
+// moved into the pack after each song, pack_names keep the real names
+static PackWriter* pack_writer = NULL;
+static const char* pack_path = NULL;
+static std::atomic<int> next_scratch_id(0);
+static thread_local int scratch_id = -1;
+static thread_local char* pack_names[MAX_OUTPUTS];
+
+// Set while a file is being indexed (--index): parsing fills it in, and
+// nothing is emulated or written
+static thread_local FileIndexEntry* index_entry = NULL;
+
+// Convert only this song of the file (batch jobs), or all of them if -1
+static thread_local int only_song = -1;
+
+// Machine every song is emulated on (--machine), or -1 for the one found by
+// the port scan
+static int machine_override = -1;
+
+// Machine detection by emulating the first frames (--detect probe) instead
+// of the static port scan. Songs the scan can't place are probed either way.
+static int probe_detection = 0;
+
+// Audio rendering settings for the wav/pcm outputs
+PcmSettings pcm_settings = { 44100, STEREO_ABC, 0 };
+
+// Frame stream cache (--cache), keyed per song of the current AY file
+const char* cache_dir = NULL;
+static thread_local uint64_t ay_file_hash = 0;
+static thread_local int current_song = 0;
+
+// Performance statistics (--stats, --stats-json): the song being converted
+// on this thread, and every finished song of the run
+static int stats_enabled = 0;
+static const char* stats_json_path = NULL;
+static thread_local const char* input_path = NULL;
+static thread_local SongStats current_stats;
+static thread_local int current_stats_valid = 0;
+static thread_local std::chrono::steady_clock::time_point song_start;
+static std::mutex stats_mutex;
+static std::vector<SongStats> run_stats;
+
+// Dry run (--hash-only): frames go into a digest instead of the sinks and
+// nothing is written; the digest of the song just emulated on this thread
+static int hash_only = 0;
+static thread_local uint64_t song_digest = 0;
+static thread_local uint32_t song_digest_frames = 0;
+static thread_local int song_digest_valid = 0;
+
+#ifdef AY2YM_PROFILE
+// Write a hot-spot report and folded call stacks next to each song's outputs
+static int profile_enabled = 0;
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,46 +133,64 @@ void SystemCall(AY2YM* ctx) {
     }
 }
 
-uint8_t ay2ym_in(void* context, uint16_t port, uint64_t elapsed_cycles) {
-    AY2YM* ctx = (AY2YM*)context;
-    uint8_t value = 0xFF;
-    uint8_t port_hi_masked = (port >> 8) & CPC_PORT_MASK;
+// Widths of the AY registers; writes through the CPC PPI are cut to them
+static const uint8_t ay_register_masks[16] = {
+    0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0x1F, 0x3F,
+    0x1F, 0x1F, 0x1F, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF
+};
+
+static inline void write_ay_register(AY2YM* ctx, uint8_t value) {
+    ctx->ay_regs[ctx->addr_latch] = value;
+    ctx->ay_writes++;
+    if (ctx->addr_latch == 13) ctx->env_written = 1;
+}
 
-    // ZX Spectrum ports
+// ZX Spectrum ports. Return 1 if the port was one of them.
+static inline int spectrum_in(AY2YM* ctx, uint16_t port, uint8_t* value) {
     if (port == 0xBFFD) {
-        value = ctx->ay_regs[ctx->addr_latch];
+        *value = ctx->ay_regs[ctx->addr_latch];
     }
     else if ((port & 0xFF) == 0xFE) {
-        value = ctx->beeper;
-    }
-    // CPC ports reads for AY registers
-    else if (port_hi_masked == (0xF5 & CPC_PORT_MASK) || port_hi_masked == (0xF7 & CPC_PORT_MASK)) {
-        value = ctx->ay_regs[ctx->addr_latch];
+        *value = ctx->beeper;
     }
     else {
-        SystemCall(ctx);
+        return 0;
     }
-
-    return value;
+    return 1;
 }
 
-void ay2ym_out(void* context, uint16_t port, uint8_t value, uint64_t elapsed_cycles) {
-    AY2YM* ctx = (AY2YM*)context;
-    uint8_t port_hi = (port >> 8);
-    uint8_t port_hi_masked = port_hi & CPC_PORT_MASK;
-
-    // ZX Spectrum handling
+static inline int spectrum_out(AY2YM* ctx, uint16_t port, uint8_t value) {
     if (port == 0xFFFD) {
         ctx->addr_latch = value & 0x0F;
     }
     else if (port == 0xBFFD) {
-        ctx->ay_regs[ctx->addr_latch] = value;
+        ctx->spectrum_regs |= (uint16_t)(1 << ctx->addr_latch);
+        write_ay_register(ctx, value);
     }
     else if ((port & 0xFF) == 0xFE) {
         ctx->beeper = (value & 0x10) ? 1 : 0;
     }
-    // CPC ports handling
-    else if (port_hi_masked == (0xF4 & CPC_PORT_MASK)) {
+    else {
+        return 0;
+    }
+    return 1;
+}
+
+// CPC ports, decoded on the masked high byte. Return 1 if the port was one
+// of them.
+static inline int cpc_in(AY2YM* ctx, uint16_t port, uint8_t* value) {
+    uint8_t port_hi_masked = (port >> 8) & CPC_PORT_MASK;
+    if (port_hi_masked == (0xF5 & CPC_PORT_MASK) || port_hi_masked == (0xF7 & CPC_PORT_MASK)) {
+        *value = ctx->ay_regs[ctx->addr_latch];
+        return 1;
+    }
+    return 0;
+}
+
+static inline int cpc_out(AY2YM* ctx, uint16_t port, uint8_t value) {
+    uint8_t port_hi_masked = (port >> 8) & CPC_PORT_MASK;
+
+    if (port_hi_masked == (0xF4 & CPC_PORT_MASK)) {
         ctx->CPCData = value;
         // Here you might call CPCCheckPIO equivalent if needed
     }
@@ -98,48 +207,52 @@ void ay2ym_out(void* context, uint16_t port, uint8_t value, uint64_t elapsed_cyc
                 break;
             case 0x80:
                 if (ctx->addr_latch < 14) {
-                    uint8_t filtered_val;
-                    switch (ctx->addr_latch) {
-                    case 1:
-                    case 3:
-                    case 5:
-                    case 13:
-                        filtered_val = ctx->CPCData & 0x0F;
-                        break;
-                    case 6:
-                    case 8:
-                    case 9:
-                    case 10:
-                        filtered_val = ctx->CPCData & 0x1F;
-                        break;
-                    case 7:
-                        filtered_val = ctx->CPCData & 0x3F;
-                        break;
-                    default:
-                        filtered_val = ctx->CPCData;
-                        break;
-                    }
-                    ctx->ay_regs[ctx->addr_latch] = filtered_val;
+                    ctx->cpc_regs |= (uint16_t)(1 << ctx->addr_latch);
+                    write_ay_register(ctx, ctx->CPCData & ay_register_masks[ctx->addr_latch]);
                 }
                 break;
             }
             ctx->CPCSwitch = 0;
         }
     }
+    else {
+        return 0;
+    }
+    return 1;
+}
 
-    ctx->is_done = 0;
+// Port handlers. The Spectrum ports are decoded first on every machine, as
+// they always have been, so a port both protocols would take (xxFE with a
+// CPC high byte) keeps its Spectrum meaning. The CPC ports are still honoured
+// so a misdetected file keeps its writes.
+uint8_t ay2ym_in(void* context, uint16_t port, uint64_t /*elapsed_cycles*/) {
+    AY2YM* ctx = (AY2YM*)context;
+    uint8_t value = 0xFF;
+    if (!spectrum_in(ctx, port, &value) && !cpc_in(ctx, port, &value)) SystemCall(ctx);
+    return value;
 }
 
-static void pack_uint32_be(uint32_t value, unsigned char* out) {
-    out[0] = (value >> 24) & 0xFF;
-    out[1] = (value >> 16) & 0xFF;
-    out[2] = (value >> 8) & 0xFF;
-    out[3] = value & 0xFF;
+void ay2ym_out(void* context, uint16_t port, uint8_t value, uint64_t /*elapsed_cycles*/) {
+    AY2YM* ctx = (AY2YM*)context;
+    if (!spectrum_out(ctx, port, value)) cpc_out(ctx, port, value);
+    ctx->is_done = 0;
 }
 
-static void pack_uint16_be(uint16_t value, unsigned char* out) {
-    out[0] = (value >> 8) & 0xFF;
-    out[1] = value & 0xFF;
+// A run of writes to one port. Writes to the Spectrum data port only leave
+// the last value in the latched register, so they are applied at once.
+void ay2ym_out_block(void* context, uint16_t port, const uint8_t* data, int count, int step,
+    uint64_t elapsed_cycles)
+{
+    AY2YM* ctx = (AY2YM*)context;
+    if (port == 0xBFFD) {
+        ctx->spectrum_regs |= (uint16_t)(1 << ctx->addr_latch);
+        ctx->ay_regs[ctx->addr_latch] = data[(count - 1) * step];
+        ctx->ay_writes += count;
+        if (ctx->addr_latch == 13) ctx->env_written = 1;
+        ctx->is_done = 0;
+        return;
+    }
+    for (int i = 0; i < count; i++) ay2ym_out(ctx, port, data[i * step], elapsed_cycles);
 }
 
 // Read signed 16-bit big-endian
@@ -167,30 +280,11 @@ const char* read_ntstring(const uint8_t* file, size_t size, size_t offset) {
     return (const char*)(file + offset);
 }
 
-// Returns 0 on success, -1 on allocation failure
-int append_bytes(
-    unsigned char** p_data, size_t* p_size, size_t* p_capacity,
-    const void* src, size_t length, FILE* file_to_close_on_fail)
-{
-    if (*p_size + length > *p_capacity) {
-        size_t new_capacity = (*p_capacity) * 2;
-        if (new_capacity < *p_size + length)
-            new_capacity = *p_size + length;
-        unsigned char* new_data = (unsigned char*)realloc(*p_data, new_capacity);
-        if (!new_data) {
-            free(*p_data);
-            if (file_to_close_on_fail) fclose(file_to_close_on_fail);
-            *p_data = nullptr;
-            *p_capacity = 0;
-            *p_size = 0;
-            return -1;
-        }
-        *p_data = new_data;
-        *p_capacity = new_capacity;
-    }
-    memcpy(*p_data + *p_size, src, length);
-    *p_size += length;
-    return 0;
+// Copy of a string in the file that stops at the end of the file
+static std::string file_string(const uint8_t* file, size_t size, const char* text) {
+    const char* start = (const char*)file;
+    if (text < start || text >= start + size) return text;
+    return std::string(text, strnlen(text, start + size - text));
 }
 
 // Sanitize a filename component by replacing invalid Windows chars with '_'
@@ -210,8 +304,8 @@ void sanitize_filename_part(const char* src, char* dest, size_t max_len) {
     dest[j] = '\0';
 }
 
-char* create_filename_from_song(uint8_t index, const char* input_name, const char* song_name) {
-    if (!input_name || !song_name) return NULL;
+char* create_filename_from_song(Arena* arena, uint8_t index, const char* input_name, const char* song_name, const char* extension) {
+    if (!input_name || !song_name || !extension) return NULL;
 
     // Find last path separator (either / or \)
     const char* last_slash1 = strrchr(input_name, '/');
@@ -228,56 +322,46 @@ char* create_filename_from_song(uint8_t index, const char* input_name, const cha
 
     // Sanitize original filename
     size_t filename_len = strlen(original_filename);
-    char* safe_filename = (char*)malloc(filename_len + 1);
+    char* safe_filename = (char*)arena_alloc(arena, filename_len + 1);
     if (!safe_filename) return NULL;
     sanitize_filename_part(original_filename, safe_filename, filename_len + 1);
 
     // Sanitize song_name too
     size_t song_len = strlen(song_name);
-    char* safe_song = (char*)malloc(song_len + 1);
-    if (!safe_song) {
-        free(safe_filename);
-        return NULL;
-    }
+    char* safe_song = (char*)arena_alloc(arena, song_len + 1);
+    if (!safe_song) return NULL;
     sanitize_filename_part(song_name, safe_song, song_len + 1);
 
-    // Construct final string: [path][safe_filename] - [XX] [safe_song].ym
+    // Construct final string: [path][safe_filename] - [XX] [safe_song].[ext]
     // Max 2 digits + space = 3 chars for index part
-    size_t total_len = path_len + strlen(safe_filename) + 3 + 3 + strlen(safe_song) + 3 + 1;
+    size_t total_len = path_len + strlen(safe_filename) + 3 + 3 + strlen(safe_song) + 1 + strlen(extension) + 1;
 
-    char* filename = (char*)malloc(total_len);
-    if (!filename) {
-        free(safe_filename);
-        free(safe_song);
-        return NULL;
-    }
+    char* filename = (char*)arena_alloc(arena, total_len);
+    if (!filename) return NULL;
 
     // Copy path part if any
     if (path_len > 0) {
         memcpy(filename, input_name, path_len);
     }
 
-    // Format filename: [safe_filename] - [XX] [safe_song].ym
+    // Format filename: [safe_filename] - [XX] [safe_song].[ext]
     snprintf(filename + path_len, total_len - path_len,
-        "%s - %02u %s.ym", safe_filename, index, safe_song);
-
-    free(safe_filename);
-    free(safe_song);
+        "%s - %02u %s.%s", safe_filename, index, safe_song, extension);
 
     return filename;
 }
 
-char* remove_file_extension(const char* filename) {
+char* remove_file_extension(Arena* arena, const char* filename) {
     // Find last '.' in the string
     const char* dot = strrchr(filename, '.');
 
     // If no dot found, or it's the first char (hidden files like .bashrc), return full name
     if (!dot || dot == filename)
-        return strdup(filename);
+        return arena_strdup(arena, filename);
 
     // Allocate space for the new string
     size_t len = dot - filename;
-    char* result = (char*)malloc(len + 1);
+    char* result = (char*)arena_alloc(arena, len + 1);
     if (!result) return NULL;
 
     // Copy the part before the dot
@@ -300,7 +384,7 @@ static void dump_memory_range(const uint8_t* memory, uint16_t start, uint16_t en
 
 void dump_relative_pointer(const uint8_t* file, size_t size, size_t pointer_pos, const char* label) {
     if (pointer_pos + 2 > size) {
-        printf("[!] %s at 0x%zX: out of bounds\n", label, pointer_pos);
+        log_printf("[!] %s at 0x%zX: out of bounds\n", label, pointer_pos);
         return;
     }
 
@@ -309,13 +393,13 @@ void dump_relative_pointer(const uint8_t* file, size_t size, size_t pointer_pos,
     int16_t rel = (int16_t)((hi << 8) | lo);
     int64_t abs_off = (int64_t)pointer_pos + rel;
 
-    printf("[REL PTR] %s: at 0x%04zX -> rel=0x%04X (%d) -> abs=0x%04llX\n",
+    log_printf("[REL PTR] %s: at 0x%04zX -> rel=0x%04X (%d) -> abs=0x%04llX\n",
         label, pointer_pos, (hi << 8) | lo, rel, abs_off);
 
     if (abs_off < 0 || (size_t)abs_off >= size)
-        printf("   [X] Absolute address 0x%04llX out of bounds!\n", abs_off);
+        log_printf("   [X] Absolute address 0x%04llX out of bounds!\n", abs_off);
     else
-        printf("   [O] Points to value: 0x%02X 0x%02X 0x%02X ...\n",
+        log_printf("   [O] Points to value: 0x%02X 0x%02X 0x%02X ...\n",
             file[abs_off], file[abs_off + 1], file[abs_off + 2]);
 }
 
@@ -332,10 +416,14 @@ void load_blocks(const uint8_t* file, size_t size, uint16_t init, size_t p_addre
     result.detected = MACHINE_UNKNOWN;
     result.spectrum_port_count = 0;
     result.cpc_port_count = 0;
-    int ula_port_count = 0;
+    result.block_count = 0;
+    result.block_bytes = 0;
+    result.ula_port_count = 0;
+    result.undetected_port_count = 0;
+    const int scan = !probe_detection || index_entry;
 
     if (p_addresses_offset == SIZE_MAX) {
-        printf("\tNo blocks data\n");
+        log_printf("\tNo blocks data\n");
         return;
     }
 
@@ -352,95 +440,39 @@ void load_blocks(const uint8_t* file, size_t size, uint16_t init, size_t p_addre
 
         if ((uint32_t)addr + length > 65536) {
             length = 65536 - addr;
-            printf("\tClamped length to 0x%X due to memory size\n", length);
+            log_printf("\tClamped length to 0x%X due to memory size\n", length);
         }
 
         if (offset_abs + length > size) {
             length = (size > offset_abs ? size - offset_abs : 0) > UINT16_MAX
                 ? UINT16_MAX
                 : (uint16_t)(size > offset_abs ? size - offset_abs : 0);
-            printf("\tClamped length to 0x%X due to file size\n", length);
+            log_printf("\tClamped length to 0x%X due to file size\n", length);
         }
 
         if (length == 0) {
-            printf("\tZero length block after clamping, skipping\n");
+            log_printf("\tZero length block after clamping, skipping\n");
             break;
         }
 
         memcpy(ctx.memory + addr, file + offset_abs, length);
-        printf("\tCopying block addr=0x%04X length=0x%X from file offset=0x%lX\n\n",
+        result.block_count++;
+        result.block_bytes += length;
+        log_printf("\tCopying block addr=0x%04X length=0x%X from file offset=0x%lX\n\n",
             addr, length, (unsigned long)offset_abs);
 
-        for (size_t i = 0; i + 3 < length; i++) {
-            uint8_t opcode = ctx.memory[addr + i];
-            uint8_t operand = ctx.memory[addr + i + 1];
-
-            if (opcode == 0xED &&
-                (operand == 0x41 || operand == 0x49 || operand == 0x51 ||
-                    operand == 0x59 || operand == 0x61 || operand == 0x69 ||
-                    operand == 0x79)) {
-
-                uint16_t port = (ctx.memory[addr + i + 3] << 8) | ctx.memory[addr + i + 2];
-                uint8_t port_hi = port >> 8;
-
-                printf("\t[DBG] OUT (C),r opcode 0x%02X to 0x%04X at 0x%04zX\n",
-                    operand, port, addr + i);
-
-                bool detected = false;
-
-                if ((port & 0xFF00) == 0xFD00) {
-                    result.spectrum_port_count++;
-                    printf("\t[DBG] Detected as ZX Spectrum AY port (OUT (C),r)\n");
-                    detected = true;
-                }
-                else if (port_hi < 0xF0) {
-                    uint16_t bbb = (port & 0x0E00) >> 9;
-                    if (bbb <= 7) {
-                        result.cpc_port_count++;
-                        printf("\t[DBG] Detected as CPC 4MB extension port (bbb = %u)\n", bbb);
-                        detected = true;
-                    }
-                }
-
-                if (!detected) {
-                    printf("\t[DBG] OUT (C),r to 0x%04X at 0x%04zX undetected\n", port, addr + i);
-                }
-            }
-
-            if (opcode == 0xD3) {
-                uint8_t port = ctx.memory[addr + i + 1];
-                printf("\t[DBG] OUT (n),A to 0x%02X at 0x%04lX\n", port, (unsigned long)(addr + i));
-
-                bool detected = false;
-
-                if (port == 0xFD || port == 0xBB) {
-                    result.spectrum_port_count++;
-                    printf("\t[DBG] Detected as ZX Spectrum AY port\n");
-                    detected = true;
-                }
-
-                if ((port & CPC_PORT_MASK) == (0xF4 & CPC_PORT_MASK) ||
-                    (port & CPC_PORT_MASK) == (0xF6 & CPC_PORT_MASK)) {
-                    result.cpc_port_count++;
-                    printf("\t[DBG] Detected as CPC AY port (OUT n,A)\n");
-                    detected = true;
-                }
-
-                if (port == 0xFE) {
-                    ula_port_count++;
-                    printf("\t[DBG] Detected as ZX Spectrum ULA port write (0xFE)\n");
-                    detected = true;
-                }
-
-                if (!detected) {
-                    printf("\t[DBG] OUT (n),A to 0x%02X at 0x%04lX undetected\n", port, (unsigned long)(addr + i));
-                }
-            }
-        }
+        // With --detect probe the first frames decide instead (the index
+        // still records the scan)
+        if (scan) portscan_block(file + offset_abs, length, &result);
 
         pos += 6;
     }
 
+    if (!scan) {
+        log_printf("Machine will be probed from the first frames.\n\n");
+        return;
+    }
+
     if (result.spectrum_port_count > result.cpc_port_count) {
         result.detected = MACHINE_ZX_SPECTRUM;
     }
@@ -457,21 +489,22 @@ void load_blocks(const uint8_t* file, size_t size, uint16_t init, size_t p_addre
         }
         else if (init >= 0xC000) {
             result.detected = MACHINE_ZX_SPECTRUM;
-            printf("[DBG] Heuristic: init address 0x%04X suggests ZX Spectrum\n", init);
+            log_printf("[DBG] Heuristic: init address 0x%04X suggests ZX Spectrum\n", init);
         }
         else if (init >= 0x8000 && init < 0xC000) {
             result.detected = MACHINE_AMSTRAD_CPC;
-            printf("[DBG] Heuristic: init address 0x%04X suggests Amstrad CPC\n", init);
+            log_printf("[DBG] Heuristic: init address 0x%04X suggests Amstrad CPC\n", init);
         }
         else {
             result.detected = MACHINE_UNKNOWN;
         }
     }
 
-    printf("\nAmstrad CPC AY port count: %d\n", result.cpc_port_count);
-    printf("ZX Spectrum AY port count: %d\n", result.spectrum_port_count);
-    printf("ZX Spectrum ULA port writes: %d\n", ula_port_count);
-    printf("Detected machine: %s\n\n",
+    log_printf("\nAmstrad CPC AY port count: %d\n", result.cpc_port_count);
+    log_printf("ZX Spectrum AY port count: %d\n", result.spectrum_port_count);
+    log_printf("ZX Spectrum ULA port writes: %d\n", result.ula_port_count);
+    log_printf("Port writes not placed: %d\n", result.undetected_port_count);
+    log_printf("Detected machine: %s\n\n",
         result.detected == MACHINE_ZX_SPECTRUM ? "ZX Spectrum" :
         result.detected == MACHINE_AMSTRAD_CPC ? "Amstrad CPC" :
         "Unknown");
@@ -479,31 +512,39 @@ void load_blocks(const uint8_t* file, size_t size, uint16_t init, size_t p_addre
     // Pure beeper track detection
     if (result.spectrum_port_count == 0 &&
         result.cpc_port_count == 0 &&
-        ula_port_count > 0) {
-        printf("[INFO] Pure beeper track detected.\n");
+        result.ula_port_count > 0) {
+        log_printf("[INFO] Pure beeper track detected.\n");
         result.detected = MACHINE_UNKNOWN;
     }
 }
 
 // Initialize CPU registers
-static void setup_cpu(uint16_t stack, uint8_t hi_reg, uint8_t lo_reg) {
-    Z80Reset(&cpu);
+static void setup_cpu(Z80_STATE* cpu, uint16_t stack, uint8_t hi_reg, uint8_t lo_reg) {
+    Z80Reset(cpu);
  
-    cpu.pc = 0x000;
-    cpu.i = 0x003;
-    cpu.registers.word[Z80_SP] = stack;
-
-    cpu.registers.byte[Z80_A] = hi_reg;
-    cpu.registers.byte[Z80_F] = lo_reg;
-    cpu.registers.byte[Z80_B] = hi_reg;
-    cpu.registers.byte[Z80_C] = lo_reg;
-    cpu.registers.byte[Z80_D] = hi_reg;
-    cpu.registers.byte[Z80_E] = lo_reg;
-    cpu.registers.byte[Z80_H] = hi_reg;
-    cpu.registers.byte[Z80_L] = lo_reg;
-
-    cpu.iff1 = 0;
-    cpu.iff2 = 0;
+    cpu->pc = 0x000;
+    cpu->i = 0x003;
+    cpu->registers.word[Z80_SP] = stack;
+
+    cpu->registers.byte[Z80_A] = hi_reg;
+    cpu->registers.byte[Z80_F] = lo_reg;
+    cpu->registers.byte[Z80_B] = hi_reg;
+    cpu->registers.byte[Z80_C] = lo_reg;
+    cpu->registers.byte[Z80_D] = hi_reg;
+    cpu->registers.byte[Z80_E] = lo_reg;
+    cpu->registers.byte[Z80_H] = hi_reg;
+    cpu->registers.byte[Z80_L] = lo_reg;
+
+    // Z80Reset leaves these alone; per the AY spec they get hi/lo as well,
+    // and nothing may leak over from the previous song
+    uint16_t pair = (uint16_t)((hi_reg << 8) | lo_reg);
+    cpu->registers.word[Z80_IX] = pair;
+    cpu->registers.word[Z80_IY] = pair;
+    for (int i = 0; i < 4; i++) cpu->alternates[i] = pair;
+    cpu->r = 0;
+
+    cpu->iff1 = 0;
+    cpu->iff2 = 0;
 }
 
 static const unsigned char intz[] = {
@@ -545,227 +586,445 @@ static void setup_interrupt_handler(uint8_t* memory, uint16_t init_addr, uint16_
     }
 }
 
-static void emulate_song(
-    uint16_t stack, uint16_t init, uint16_t song_length, uint16_t fade_length,
-    uint8_t hi_reg, uint8_t lo_reg, uint16_t interrupt_addr)
+// Called once per emulated frame with the AY registers sampled at the interrupt
+typedef int (*FrameCallback)(void* user, const uint8_t regs[16], int env_written);
+
+// The stub's code after `call init` (im, ei, halt, ...). Once the CPU is
+// back there, init has returned.
+static int init_has_returned(uint16_t interrupt_addr) {
+    size_t stub_size = interrupt_addr == 0 ? sizeof(intz) : sizeof(intnz);
+    return cpu.pc >= 4 && (size_t)cpu.pc < stub_size;
+}
+
+#ifdef AY2YM_ALLOC_CHECK
+// The frame loop must not allocate: everything a song needs is set up
+// before it starts (the profiler's call tree is the one exception)
+static void check_frame_loop_allocations(uint64_t allocations) {
+#ifdef AY2YM_PROFILE
+    if (ctx.profiler) return;
+#endif
+    if (allocations == 0) return;
+    fprintf(stderr, "[ALLOC] %llu heap allocations in the frame loop of '%s' song %d\n",
+        (unsigned long long)allocations, input_path ? input_path : "?", current_song);
+    abort();
+}
+#endif
+
+// Run the CPU until total_cycles, calling on_frame at every interrupt and
+// continuing from *position. With stop_after_init set, returns 1 as soon as
+// init has returned. Returns 0 when done, or -1 if on_frame failed.
+template <int Id>
+static int run_frames(uint64_t total_cycles, FrameCallback on_frame, void* user,
+    EmulationPosition* position, int stop_after_init, uint16_t interrupt_addr)
 {
-    memset(ctx.ay_regs, 0, sizeof(ctx.ay_regs));
-    ctx.ay_reg_select = 0;
-    ctx.is_done = 0;
+    constexpr uint64_t int_tstates = machine_profiles[Id].frame_tstates;
+    int status = 0;
 
-    setup_interrupt_handler(ctx.memory, init, interrupt_addr);
+#ifdef AY2YM_ALLOC_CHECK
+    allocwatch_begin();
+#endif
 
-    printf("Setting up CPU: stack=0x%04X init=0x0000 hi_reg=0x%02X lo_reg=0x%02X interrupt=0x%04X\n",
-        stack, hi_reg, lo_reg, interrupt_addr);
+    while (position->cycles < total_cycles && !ctx.is_done) {
+        int elapsed = Z80Emulate(&cpu, EMULATION_STEP_CYCLES, &ctx);
+        if (elapsed <= 0) break;
+        position->cycles += elapsed;
+#ifdef AY2YM_PROFILE
+        if (ctx.profiler) profiler_step_end(ctx.profiler, elapsed);
+#endif
 
-    setup_cpu(stack, hi_reg, lo_reg);
+        if (position->cycles >= position->next_frame) {
+            if (cpu.iff1 == 1) {
+                Z80Interrupt(&cpu, 0, &ctx);
+                ctx.interrupts++;
+#ifdef AY2YM_PROFILE
+                if (ctx.profiler) profiler_interrupt(ctx.profiler);
+#endif
+            }
+#ifdef AY2YM_PROFILE
+            if (ctx.profiler) profiler_frame(ctx.profiler);
+#endif
 
-    const uint64_t cpu_clock = (result.detected == MACHINE_AMSTRAD_CPC) ? 4000000ULL : 3500000ULL;
-	printf("CPU clock: %llu Hz\n", cpu_clock);
+            if (on_frame(user, ctx.ay_regs, ctx.env_written) != 0) {
+                status = -1;
+                break;
+            }
+            ctx.env_written = 0;
 
-    const uint64_t int_tstates = cpu_clock / FRAME_RATE;
-    uint64_t total_cycles = (uint64_t)(song_length + fade_length) * int_tstates;
+            position->frames++;
+            position->next_frame += int_tstates;
+        }
 
-    printf("Starting emulation for %llu cycles (~%.2fs)...\n\n",
-        total_cycles, (double)total_cycles / cpu_clock);
+        if (stop_after_init && init_has_returned(interrupt_addr)) {
+            status = 1;
+            break;
+        }
+    }
 
-    uint64_t cycles = 0;
-    uint64_t next_frame = int_tstates;
-    const int step_cycles = 100;
-    int frame_number = 0;
+#ifdef AY2YM_ALLOC_CHECK
+    check_frame_loop_allocations(allocwatch_end());
+#endif
+    return status;
+}
 
-    FILE* ym_file = fopen(output_file, "wb");
-    if (NULL == ym_file) {
-        printf("Can't open output file '%s'\n", output_file);
-        return;
+// run_frames() for the machine of the current song
+static int emulate_frames(uint64_t total_cycles, FrameCallback on_frame, void* user,
+    EmulationPosition* position, int stop_after_init, uint16_t interrupt_addr)
+{
+    return machine_dispatch(ctx.machine, [&](auto tag) {
+        return run_frames<decltype(tag)::id>(total_cycles, on_frame, user, position, stop_after_init, interrupt_addr);
+    });
+}
+
+// Where emulated frames go: the output sinks (or the digest with
+// --hash-only), and the cache log if enabled
+typedef struct FrameTarget {
+    SinkSet* sinks;
+    FrameLog* log;
+    uint64_t digest;
+} FrameTarget;
+
+static int push_frame(void* user, const uint8_t regs[16], int env_written) {
+    FrameTarget* target = (FrameTarget*)user;
+    if (target->sinks) {
+        sinkset_push(target->sinks, regs, env_written);
     }
+    else {
+        target->digest = hash64(target->digest, regs, 16);
+        target->digest = hash64_u32(target->digest, env_written != 0);
+    }
+    if (target->log && framelog_append(target->log, regs, env_written) != 0) {
+        log_printf("Out of memory for the cache log, song won't be cached.\n");
+        framelog_free(target->log);
+        target->log = NULL;
+    }
+    return 0;
+}
 
-    size_t ym_capacity = 65536;
-    size_t ym_size = 0;
-    unsigned char* ym_data = (unsigned char*)malloc(ym_capacity);
-    if (!ym_data) {
-        fclose(ym_file);
-        return;
+// Room for every frame of the song in the cache log up front, so the frame
+// loop doesn't allocate
+static void reserve_cache_log(FrameTarget* target, uint32_t frames) {
+    if (target->log && framelog_reserve(target->log, frames) != 0) {
+        log_printf("Out of memory for the cache log, song won't be cached.\n");
+        framelog_free(target->log);
+        target->log = NULL;
     }
+}
 
-    unsigned char packed[4];
-
-    // Write YM6 file ID and check string
-    append_bytes(&ym_data, &ym_size, &ym_capacity, "YM6!", 4, ym_file);
-    append_bytes(&ym_data, &ym_size, &ym_capacity, "LeOnArD!", 8, ym_file);
-
-    // Number of frames placeholder
-    size_t frame_count_offset = ym_size;
-    pack_uint32_be(0, packed);
-    append_bytes(&ym_data, &ym_size, &ym_capacity, packed, 4, ym_file);
-
-    // Song attributes: 0x09 (interleaved | AY-compatible)
-    uint32_t song_attributes = 0x09;
-    pack_uint32_be(song_attributes, packed);
-    append_bytes(&ym_data, &ym_size, &ym_capacity, packed, 4, ym_file);
-
-    // Number of digidrums
-    pack_uint32_be(0, packed);
-    append_bytes(&ym_data, &ym_size, &ym_capacity, packed, 2, ym_file);
-
-    // Master clock
-    pack_uint32_be(result.detected == MACHINE_AMSTRAD_CPC ? AMSTRAD_CPC_CLOCK : ZX_SPECTRUM_CLOCK, packed);
-	printf("Master clock: %u Hz\n", (unsigned int)(result.detected == MACHINE_AMSTRAD_CPC ? AMSTRAD_CPC_CLOCK : ZX_SPECTRUM_CLOCK));
-    append_bytes(&ym_data, &ym_size, &ym_capacity, packed, 4, ym_file);
-
-    // Player frequency
-    pack_uint16_be(FRAME_RATE, packed);
-    append_bytes(&ym_data, &ym_size, &ym_capacity, packed, 2, ym_file);
-
-    // VBL loop position
-    pack_uint32_be(0, packed);
-    append_bytes(&ym_data, &ym_size, &ym_capacity, packed, 4, ym_file);
-
-    // Additional data size
-    pack_uint16_be(0, packed);
-    append_bytes(&ym_data, &ym_size, &ym_capacity, packed, 2, ym_file);
-
-    // Song name, author, comment
-    append_bytes(&ym_data, &ym_size, &ym_capacity, song_name, strlen(song_name), ym_file);
-    ym_data[ym_size++] = 0;
-    append_bytes(&ym_data, &ym_size, &ym_capacity, author, strlen(author), ym_file);
-    ym_data[ym_size++] = 0;
-    const char* comment = "Converted by Negative Charge(@negativecharge.bsky.social)";
-    append_bytes(&ym_data, &ym_size, &ym_capacity, comment, strlen(comment), ym_file);
-    ym_data[ym_size++] = 0;
-
-    // Tone data buffer
-    size_t tone_capacity = 1024;
-    size_t tone_size = 0;
-    unsigned char* tone_data = (unsigned char*)malloc(tone_capacity);
-    if (!tone_data) {
-        free(ym_data);
-        fclose(ym_file);
-        return;
+static void init_song_info(SongInfo* info, const MachineProfile& machine, uint32_t frame_budget) {
+    info->title = song_name;
+    info->author = author;
+    info->ay_clock = machine.ay_clock;
+    info->frame_rate = machine_frame_rate(machine);
+    info->cpu_clock = machine.cpu_clock;
+    info->frame_tstates = machine.frame_tstates;
+    info->frame_budget = frame_budget;
+    info->pcm = pcm_settings;
+}
+
+// Settings that change the emulated frames and so must be part of the cache key.
+// Without --machine the frame rate follows the machine detected from the
+// file, which the entry records.
+static const char* emulation_options() {
+    static char options[64];
+    if (machine_override >= 0) {
+        const MachineProfile& machine = machine_profiles[machine_override];
+        snprintf(options, sizeof(options), "frame_rate=%u,machine=%s", machine_frame_rate(machine), machine.name);
+    }
+    else if (probe_detection) {
+        snprintf(options, sizeof(options), "frame_rate=machine,detect=probe");
     }
-    memset(tone_data, 0, tone_capacity);
+    else {
+        snprintf(options, sizeof(options), "frame_rate=machine");
+    }
+    return options;
+}
 
-    // Emulation loop
-    while (cycles < total_cycles && !ctx.is_done) {
-        int elapsed = Z80Emulate(&cpu, step_cycles, &ctx);
-        if (elapsed <= 0) break;
-        cycles += elapsed;
+static uint64_t current_cache_key() {
+    return framecache_key(ay_file_hash, current_song, emulation_options());
+}
 
-        if (cycles >= next_frame) {
-            if (cpu.iff1 == 1) {
-                Z80Interrupt(&cpu, 0, &ctx);
-            }
+// Feed a cached frame stream to the sinks. Returns 1 on a cache hit.
+static int replay_cached_song() {
+    FrameLog log = {};
+    if (framecache_load(cache_dir, current_cache_key(), &log) != 0) {
+        return 0;
+    }
+    if (log.machine >= PROFILE_COUNT) {
+        framelog_free(&log);
+        return 0;
+    }
+    const MachineProfile& machine = machine_profiles[log.machine];
 
-            if (tone_size + 16 > tone_capacity) {
-                tone_capacity *= 2;
-                unsigned char* new_tone_data = (unsigned char*)realloc(tone_data, tone_capacity);
-                if (!new_tone_data) {
-                    free(tone_data);
-                    free(ym_data);
-                    fclose(ym_file);
-                    return;
-                }
-                tone_data = new_tone_data;
-            }
+    log_printf("Cache hit: %u frames, skipping emulation.\n", log.count);
 
-            for (int i = 0; i < 16; i++) {
-                tone_data[tone_size++] = ctx.ay_regs[i];
-            }
+    SongInfo info;
+    init_song_info(&info, machine, log.count);
 
-            frame_number++;
-            next_frame += int_tstates;
+    SinkSet sinks;
+    if (sinkset_open(&sinks, output_formats, output_files, output_format_count, &info, sink_arenas) == 0) {
+        sinkset_start(&sinks);
+        for (uint32_t i = 0; i < log.count; i++) {
+            sinkset_push(&sinks, log.frames[i].regs, log.frames[i].env_written);
+        }
+        if (sinkset_finish(&sinks) == 0) {
+            log_printf("No output written for this song.\n");
         }
     }
 
-    // If no frames were generated, delete and exit
-    if (frame_number == 0) {
-        printf("No frames generated during emulation; deleting output file.\n");
-        fclose(ym_file);
-        free(ym_data);
-        free(tone_data);
-        if (remove(output_file) != 0) {
-            printf("Warning: Failed to delete output file '%s'\n", output_file);
-        }
-        return;
+    current_stats.cached = 1;
+    current_stats.frames = log.count;
+    current_stats.play_seconds = (double)log.count * machine.frame_tstates / machine.cpu_clock;
+    current_stats_valid = 1;
+
+    framelog_free(&log);
+    return 1;
+}
+
+#ifdef AY2YM_PROFILE
+static void write_profile(const Profiler* profiler, uint64_t frame_tstates) {
+    char* report = create_filename_from_song(&song_arena, current_song, orig_file_name, song_name, "profile.txt");
+    char* folded = create_filename_from_song(&song_arena, current_song, orig_file_name, song_name, "folded");
+    if (report && profiler_write_report(profiler, report, song_name, frame_tstates) == 0) {
+        log_printf("Profile written to %s\n", report);
     }
+    if (folded) profiler_write_folded(profiler, folded, song_name);
+}
+#endif
 
-    // Trim trailing zero frames
-    int zero_frame_count = 0;
-    for (int i = frame_number - 1; i >= 0; i--) {
-        int all_zero = 1;
-        for (int reg = 0; reg < 16; reg++) {
-            if (tone_data[i * 16 + reg] != 0) {
-                all_zero = 0;
-                break;
+// Nothing carries over from the previous song, so a song's frames only
+// depend on its own data (the caches rely on that)
+static void reset_song_state() {
+    memset(ctx.ay_regs, 0, sizeof(ctx.ay_regs));
+    ctx.ay_reg_select = 0;
+    ctx.is_done = 0;
+    ctx.env_written = 0;
+    ctx.addr_latch = 0;
+    ctx.beeper = 0;
+    ctx.CPCData = 0;
+    ctx.CPCSwitch = 0;
+    ctx.spectrum_regs = 0;
+    ctx.cpc_regs = 0;
+    ctx.instructions = 0;
+    ctx.ay_writes = 0;
+    ctx.interrupts = 0;
+}
+
+// Frames emulated while probing, handed to the sinks once they are open
+typedef struct ProbeFrames {
+    FrameRecord frames[PROBE_FRAMES];
+    uint32_t count;
+} ProbeFrames;
+
+static int record_probe_frame(void* user, const uint8_t regs[16], int env_written) {
+    ProbeFrames* probe = (ProbeFrames*)user;
+    if (probe->count == PROBE_FRAMES) return -1;
+    memcpy(probe->frames[probe->count].regs, regs, 16);
+    probe->frames[probe->count].env_written = (uint8_t)(env_written != 0);
+    probe->count++;
+    return 0;
+}
+
+static int count_bits(uint16_t bits) {
+    int count = 0;
+    for (; bits; bits &= bits - 1) count++;
+    return count;
+}
+
+// Run the first PROBE_FRAMES frames on the current machine with both AY
+// protocols decoded, and pick the machine whose protocol reached more of the
+// sound registers (0-13). Returns the profile, or -1 if neither protocol
+// reached PROBE_MIN_REGISTERS of them.
+static int probe_machine(uint16_t song_frames, EmulationPosition* position, ProbeFrames* probe,
+    uint16_t interrupt_addr)
+{
+    const MachineProfile& provisional = machine_profiles[ctx.machine];
+    uint32_t frames = song_frames < PROBE_FRAMES ? song_frames : PROBE_FRAMES;
+    emulate_frames((uint64_t)frames * provisional.frame_tstates, record_probe_frame, probe, position, 0, interrupt_addr);
+
+    int spectrum = count_bits(ctx.spectrum_regs & 0x3FFF);
+    int cpc = count_bits(ctx.cpc_regs & 0x3FFF);
+    log_printf("Probe: %u frames, %d registers written through Spectrum ports, %d through the CPC PPI\n",
+        probe->count, spectrum, cpc);
+
+    if (spectrum < PROBE_MIN_REGISTERS && cpc < PROBE_MIN_REGISTERS) return -1;
+    if (cpc > spectrum || (cpc == spectrum && provisional.ports == MACHINE_PORTS_CPC)) return PROFILE_CPC;
+    return provisional.ports == MACHINE_PORTS_SPECTRUM ? (int)ctx.machine : (int)PROFILE_SPECTRUM_48;
+}
+
+static void emulate_song(
+    uint16_t stack, uint16_t init, uint16_t song_length, uint16_t fade_length,
+    uint8_t hi_reg, uint8_t lo_reg, uint16_t interrupt_addr)
+{
+    reset_song_state();
+    ctx.machine = (uint8_t)(machine_override >= 0 ? machine_override : machine_default_profile(result.detected));
+
+    setup_interrupt_handler(ctx.memory, init, interrupt_addr);
+
+    log_printf("Setting up CPU: stack=0x%04X init=0x0000 hi_reg=0x%02X lo_reg=0x%02X interrupt=0x%04X\n",
+        stack, hi_reg, lo_reg, interrupt_addr);
+
+    setup_cpu(&cpu, stack, hi_reg, lo_reg);
+
+#ifdef AY2YM_PROFILE
+    ctx.profiler = profile_enabled ? profiler_create() : NULL;
+#endif
+
+    // Without a machine from --machine or the port scan, the first frames
+    // decide. They are kept and the song runs on from there, unless the
+    // machine found has other timing than the one probed with.
+    EmulationPosition position = { 0, machine_profiles[ctx.machine].frame_tstates, 0 };
+    ProbeFrames probe;
+    probe.count = 0;
+    if (machine_override < 0 && (probe_detection || result.detected == MACHINE_UNKNOWN)) {
+        uint8_t* image = (uint8_t*)arena_alloc(&song_arena, sizeof(ctx.memory));
+        if (image) memcpy(image, ctx.memory, sizeof(ctx.memory));
+
+        int found = probe_machine(song_length + fade_length, &position, &probe, interrupt_addr);
+        if (found < 0) {
+            log_printf("No AY register activity in the first %u frames, skipping emulation.\n", probe.count);
+            // The outputs only open once the machine is known, so none exist yet
+#ifdef AY2YM_PROFILE
+            profiler_destroy(ctx.profiler);
+            ctx.profiler = NULL;
+#endif
+            return;
+        }
+
+        const MachineProfile& probed = machine_profiles[ctx.machine];
+        if (machine_profiles[found].cpu_clock != probed.cpu_clock ||
+            machine_profiles[found].frame_tstates != probed.frame_tstates) {
+            if (!image) {
+                log_printf("Out of memory for the probe restart, staying on %s.\n", probed.description);
+                found = ctx.machine;
+            }
+            else {
+                log_printf("Restarting on %s.\n", machine_profiles[found].description);
+                memcpy(ctx.memory, image, sizeof(ctx.memory));
+                reset_song_state();
+                setup_cpu(&cpu, stack, hi_reg, lo_reg);
+                position.cycles = 0;
+                position.next_frame = machine_profiles[found].frame_tstates;
+                position.frames = 0;
+                probe.count = 0;
+#ifdef AY2YM_PROFILE
+                profiler_destroy(ctx.profiler);
+                ctx.profiler = profile_enabled ? profiler_create() : NULL;
+#endif
             }
         }
-        if (all_zero) zero_frame_count++;
-        else break;
+        ctx.machine = (uint8_t)found;
     }
 
-    if (zero_frame_count > 0) {
-        frame_number -= zero_frame_count;
-        tone_size = frame_number * 16;
-        printf("Trimmed %d trailing zero frames from output.\n", zero_frame_count);
-    }
-    else {
-        printf("No trailing zero frames to trim.\n");
-    }
+    const MachineProfile& machine = machine_profiles[ctx.machine];
+    const uint64_t cpu_clock = machine.cpu_clock;
+    log_printf("Machine: %s\n", machine.description);
+    log_printf("CPU clock: %llu Hz\n", cpu_clock);
 
-    // If no frames remain after trimming, delete and exit
-    if (frame_number == 0) {
-        printf("No non-zero frames remain after trimming; deleting output file.\n");
-        fclose(ym_file);
-        free(ym_data);
-        free(tone_data);
-        if (remove(output_file) != 0) {
-            printf("Warning: Failed to delete output file '%s'\n", output_file);
+    const uint64_t int_tstates = machine.frame_tstates;
+    uint64_t total_cycles = (uint64_t)(song_length + fade_length) * int_tstates;
+
+    // The last emulation step may run past total_cycles into one more frame
+    const uint32_t song_frames = (uint32_t)(total_cycles / int_tstates) + 1;
+
+    SongInfo info;
+    init_song_info(&info, machine, song_frames);
+    log_printf("Master clock: %u Hz\n", (unsigned int)info.ay_clock);
+    log_printf("Frame rate: %u Hz\n", info.frame_rate);
+
+    // All requested formats are fed from this single emulation pass
+    SinkSet sinks;
+    if (!hash_only) {
+        if (sinkset_open(&sinks, output_formats, output_files, output_format_count, &info, sink_arenas) != 0) {
+#ifdef AY2YM_PROFILE
+            profiler_destroy(ctx.profiler);
+            ctx.profiler = NULL;
+#endif
+            return;
         }
-        return;
+        sinkset_start(&sinks);
     }
 
-    // Interleave tone data
-    size_t interleaved_size = frame_number * 16;
-    unsigned char* interleaved_data = (unsigned char*)malloc(interleaved_size);
-    if (!interleaved_data) {
-        free(tone_data);
-        free(ym_data);
-        fclose(ym_file);
-        return;
+    log_printf("Starting emulation for %llu cycles (~%.2fs)...\n\n",
+        total_cycles, (double)total_cycles / cpu_clock);
+
+    FrameLog log = {};
+    log.machine = ctx.machine;
+    FrameTarget target = { hash_only ? NULL : &sinks, cache_dir ? &log : NULL, HASH64_SEED };
+
+    uint64_t resumed_cycles = 0;
+
+    reserve_cache_log(&target, song_frames);
+    for (uint32_t i = 0; i < probe.count; i++) {
+        push_frame(&target, probe.frames[i].regs, probe.frames[i].env_written);
     }
 
-    for (int reg = 0; reg < 16; reg++) {
-        for (int f = 0; f < frame_number; f++) {
-            interleaved_data[reg * frame_number + f] = tone_data[f * 16 + reg];
+    // Resume from a stored post-init state, or record one once init returns.
+    // Snapshots are only taken from the start of a song.
+    if (target.log && position.cycles == 0) {
+        uint64_t key = snapshot_key(ctx.memory, stack, hi_reg, lo_reg, cpu_clock, machine.frame_tstates,
+            info.frame_rate);
+        if (snapshot_load(cache_dir, key, &cpu, &ctx, &position, &log) == 0) {
+            log_printf("Init snapshot hit: resuming after %u frames.\n", position.frames);
+            resumed_cycles = position.cycles;
+            for (uint32_t i = 0; i < log.count; i++) {
+                sinkset_push(&sinks, log.frames[i].regs, log.frames[i].env_written);
+            }
         }
+        else if (emulate_frames(total_cycles, push_frame, &target, &position, 1, interrupt_addr) == 1 &&
+            target.log && snapshot_store(cache_dir, key, &cpu, &ctx, &position, &log) != 0) {
+            log_printf("Failed to store init snapshot in the cache.\n");
+        }
+        reserve_cache_log(&target, song_frames);
     }
 
-    // Append interleaved data
-    append_bytes(&ym_data, &ym_size, &ym_capacity, interleaved_data, interleaved_size, ym_file);
-
-    // Append terminator
-    append_bytes(&ym_data, &ym_size, &ym_capacity, "End!", 4, ym_file);
-
-    // Patch final frame count
-    pack_uint32_be(frame_number, packed);
-    memcpy(ym_data + frame_count_offset, packed, 4);
+    emulate_frames(total_cycles, push_frame, &target, &position, 0, interrupt_addr);
+    uint64_t cycles = position.cycles;
+    int frame_number = (int)position.frames;
+
+    int kept = hash_only ? 0 : sinkset_finish(&sinks);
+
+    current_stats.frames = position.frames;
+    current_stats.play_seconds = (double)position.frames * int_tstates / cpu_clock;
+    current_stats.cycles = position.cycles - resumed_cycles;
+    current_stats.instructions = ctx.instructions;
+    current_stats.interrupts = ctx.interrupts;
+    current_stats.ay_writes = ctx.ay_writes;
+    current_stats.cpu_clock = cpu_clock;
+    current_stats_valid = 1;
+
+#ifdef AY2YM_PROFILE
+    if (ctx.profiler) {
+        write_profile(ctx.profiler, int_tstates);
+        profiler_destroy(ctx.profiler);
+        ctx.profiler = NULL;
+    }
+#endif
 
-    // Write file
-    fseek(ym_file, 0, SEEK_SET);
-    fwrite(ym_data, 1, ym_size, ym_file);
+    if (target.log) {
+        if (framecache_store(cache_dir, current_cache_key(), &log) != 0) {
+            log_printf("Failed to store song in the cache.\n");
+        }
+        framelog_free(&log);
+    }
 
-    fclose(ym_file);
-    free(ym_data);
-    free(tone_data);
-    free(interleaved_data);
+    if (hash_only) {
+        song_digest = target.digest;
+        song_digest_frames = position.frames;
+        song_digest_valid = 1;
+        log_printf("Frame stream digest: %016llx (%u frames)\n", (unsigned long long)song_digest, position.frames);
+    }
+    else if (kept == 0) {
+        log_printf("No output written for this song.\n");
+        return;
+    }
 
-    printf("Emulation ended after %d frames, %llu cycles.\n", frame_number, cycles);
+    log_printf("Emulation ended after %d frames, %llu cycles.\n", frame_number, cycles);
 }
 
 // Parse points data and emulate
 void parse_points_data_and_emulate(const uint8_t* file, size_t size, size_t p_points_offset, size_t p_addresses_offset, uint8_t hi_reg, uint8_t lo_reg, uint16_t song_length, uint16_t fade_length) {
     if (p_points_offset == SIZE_MAX || p_points_offset + 6 > size) {
-        printf("\tNo valid points data\n");
+        log_printf("\tNo valid points data\n");
         return;
     }
 
@@ -773,7 +1032,12 @@ void parse_points_data_and_emulate(const uint8_t* file, size_t size, size_t p_po
     uint16_t init = read_be16u(file + p_points_offset + 2);
     uint16_t interrupt = read_be16u(file + p_points_offset + 4);
 
-    printf("\tPoints: stack=0x%04X init=0x%04X interrupt=0x%04X\n", stack, init, interrupt);
+    log_printf("\tPoints: stack=0x%04X init=0x%04X interrupt=0x%04X\n", stack, init, interrupt);
+
+    // A cached frame stream makes emulation unnecessary
+    if (cache_dir && !index_entry && replay_cached_song()) {
+        return;
+    }
 
     // Clear memory regions according to spec:
     memset(ctx.memory + 0x0000, 0xC9, 0x0100);     // 0x0000-0x00FF with 0xC9 (RET)
@@ -784,19 +1048,36 @@ void parse_points_data_and_emulate(const uint8_t* file, size_t size, size_t p_po
     ctx.memory[0x0038] = 0xFB;
     
     load_blocks(file, size, init, p_addresses_offset);
-	if (result.detected == MACHINE_UNKNOWN) {
-		printf("\tNo valid AY ports detected, skipping emulation.\n");
-		delete_file_if_exists(output_file);
 
-		return;
-	}
+    // Recognising the player only names it: the song is emulated either way
+    const KnownPlayer* player = player_identify(ctx.memory, init, interrupt);
+    log_printf("\tPlayer: %s\n", player ? player->name : "unknown");
+
+    if (index_entry) {
+        SongIndexEntry& song = index_entry->songs.back();
+        song.has_points = 1;
+        song.player = player ? player->name : "";
+        song.stack = stack;
+        song.init = init;
+        song.interrupt = interrupt;
+        song.machine = (uint8_t)result.detected;
+        song.spectrum_ports = (uint16_t)result.spectrum_port_count;
+        song.cpc_ports = (uint16_t)result.cpc_port_count;
+        song.block_count = (uint16_t)result.block_count;
+        song.block_bytes = result.block_bytes;
+        return;
+    }
+
+    if (result.detected == MACHINE_UNKNOWN && machine_override < 0 && !probe_detection) {
+        log_printf("\tNo valid AY ports detected, probing the first frames.\n");
+    }
     emulate_song(stack, init, song_length, fade_length, hi_reg, lo_reg, interrupt);
 }
 
 // Parse single song data
 void parse_song_data(const uint8_t* file, size_t size, size_t song_data_offset) {
     if (song_data_offset == SIZE_MAX || song_data_offset + 14 > size) {
-        printf("\tInvalid song data\n");
+        log_printf("\tInvalid song data\n");
         return;
     }
 
@@ -817,15 +1098,16 @@ void parse_song_data(const uint8_t* file, size_t size, size_t song_data_offset)
     dump_relative_pointer(file, size, song_data_offset + 10, "p_points");
     dump_relative_pointer(file, size, song_data_offset + 12, "p_addresses");
 
-    printf("\n\ta_chan=%d b_chan=%d c_chan=%d noise=%d\n", a_chan, b_chan, c_chan, noise);
-    printf("\tsong_length=%d (%.2fs)\n", song_length, song_length / 50.0);
-    printf("\tfade_length=%d (%.2fs)\n", fade_length, fade_length / 50.0);
-    printf("\thi_reg=0x%02X lo_reg=0x%02X\n", hi_reg, lo_reg);
-    printf("\tp_points=0x%zX p_addresses=0x%zX\n", p_points, p_addresses);
+    log_printf("\n\ta_chan=%d b_chan=%d c_chan=%d noise=%d\n", a_chan, b_chan, c_chan, noise);
+    log_printf("\tsong_length=%d (%.2fs)\n", song_length, song_length / 50.0);
+    log_printf("\tfade_length=%d (%.2fs)\n", fade_length, fade_length / 50.0);
+    log_printf("\thi_reg=0x%02X lo_reg=0x%02X\n", hi_reg, lo_reg);
+    log_printf("\tp_points=0x%zX p_addresses=0x%zX\n", p_points, p_addresses);
 
     // Derive song length if missing
+    uint8_t length_source = LENGTH_HEADER;
     if (song_length == 0) {
-        printf("\tNo song length provided - attempting to count addresses at p_addresses\n");
+        log_printf("\tNo song length provided - attempting to count addresses at p_addresses\n");
         if (p_addresses != SIZE_MAX) {
             size_t count = 0;
             while (p_addresses + (count * 2) + 1 < size) {
@@ -833,37 +1115,80 @@ void parse_song_data(const uint8_t* file, size_t size, size_t song_data_offset)
                 if (addr == 0x0000) break;
                 count++;
                 if (count > 15000) {  // sanity check: never let it run forever
-                    printf("\tAddress table too long - aborting at 15000 frames.\n");
+                    log_printf("\tAddress table too long - aborting at 15000 frames.\n");
                     break;
                 }
             }
             if (count >= 100) {  // if enough addresses to be a reasonable song
                 if (count > UINT16_MAX) {
-                   printf("\tWarning: count exceeds uint16_t range, truncating to UINT16_MAX.\n");
+                   log_printf("\tWarning: count exceeds uint16_t range, truncating to UINT16_MAX.\n");
                    song_length = UINT16_MAX;
                 } else {
                    song_length = static_cast<uint16_t>(count);
                 }
-                printf("\tDerived song_length=%zu (%.2fs)\n", count, count / 50.0);
+                log_printf("\tDerived song_length=%zu (%.2fs)\n", count, count / 50.0);
+                length_source = LENGTH_ADDRESS_TABLE;
             }
             else {
-                printf("\tToo few addresses (%zu) - defaulting to 5 minutes (15000 frames)\n", count);
+                log_printf("\tToo few addresses (%zu) - defaulting to 5 minutes (15000 frames)\n", count);
                 song_length = 15000;
+                length_source = LENGTH_DEFAULT;
             }
         }
         else {
-            printf("\tp_addresses invalid - defaulting to 5 minutes (15000 frames)\n");
+            log_printf("\tp_addresses invalid - defaulting to 5 minutes (15000 frames)\n");
             song_length = 15000;
+            length_source = LENGTH_DEFAULT;
         }
     }
 
+    if (index_entry) {
+        SongIndexEntry& song = index_entry->songs.back();
+        song.song_length = song_length;
+        song.fade_length = fade_length;
+        song.length_source = length_source;
+    }
+
     parse_points_data_and_emulate(file, size, p_points, p_addresses, hi_reg, lo_reg, song_length, fade_length);
 }
 
 // Parse song structure table
+// Per-worker file the sink for output k writes to in pack mode
+static char* scratch_file_name(int k) {
+    if (scratch_id < 0) scratch_id = next_scratch_id++;
+    size_t length = strlen(pack_path) + 32;
+    char* name = (char*)arena_alloc(&song_arena, length);
+    if (name) snprintf(name, length, "%s.%d.%d.tmp", pack_path, scratch_id, k);
+    return name;
+}
+
+static void stats_begin_song() {
+    current_stats = SongStats();
+    current_stats_valid = 0;
+    song_start = std::chrono::steady_clock::now();
+}
+
+// Record the song if anything was emulated or replayed for it
+static void stats_end_song(int index, const std::string& name) {
+    if (!stats_enabled || !current_stats_valid) return;
+
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - song_start;
+    current_stats.wall_seconds = wall.count();
+    current_stats.source = input_path ? input_path : "";
+    current_stats.song = index;
+    current_stats.name = name;
+    for (int k = 0; k < output_format_count && !hash_only; k++) {
+        struct stat st;
+        if (output_files[k] && stat(output_files[k], &st) == 0) current_stats.bytes_written += (uint64_t)st.st_size;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    run_stats.push_back(current_stats);
+}
+
 void parse_song_structure_table(const uint8_t* file, size_t size, size_t table_offset, int num_songs) {
     if (table_offset == SIZE_MAX) {
-        printf("Invalid songs structure pointer\n");
+        log_printf("Invalid songs structure pointer\n");
         return;
     }
 
@@ -871,7 +1196,7 @@ void parse_song_structure_table(const uint8_t* file, size_t size, size_t table_o
     size_t table_size = (num_songs + 1) * entry_size;
 
     if (table_offset + table_size > size) {
-        printf("Song table exceeds file size\n");
+        log_printf("Song table exceeds file size\n");
         return;
     }
 
@@ -881,17 +1206,38 @@ void parse_song_structure_table(const uint8_t* file, size_t size, size_t table_o
         size_t song_data_ptr = resolve_rel_pointer(file, size, entry_pos + 2);
 
         song_name = (song_name_ptr != SIZE_MAX) ? read_ntstring(file, size, song_name_ptr) : "(invalid)";
-        printf("\nSong %d: %s\n", i, song_name);
+        current_song = i;
+        if (only_song >= 0 && i != only_song) continue;
+        log_printf("\nSong %d: %s\n", i, song_name);
+
+        if (index_entry) {
+            index_entry->songs.push_back(SongIndexEntry());
+            index_entry->songs.back().index = i;
+            index_entry->songs.back().name = file_string(file, size, song_name);
+            parse_song_data(file, size, song_data_ptr);
+            continue;
+        }
 
-        output_file = create_filename_from_song(i, orig_file_name, song_name);
+        arena_rewind(&song_arena, file_mark);
+        for (int k = 0; k < output_format_count; k++) {
+            output_files[k] = create_filename_from_song(&song_arena, i, orig_file_name, song_name,
+                output_format_extension(output_formats[k]));
+            if (pack_writer) {
+                pack_names[k] = output_files[k];
+                output_files[k] = scratch_file_name(k);
+            }
+        }
+        stats_begin_song();
+        song_digest_valid = 0;
         parse_song_data(file, size, song_data_ptr);
+        stats_end_song(i, file_string(file, size, song_name));
     }
 }
 
 // Parse top-level AY file structure
 void parse_ay_file(const uint8_t* file, size_t size) {
     if (size < 20) {
-        printf("File too small\n");
+        log_printf("File too small\n");
         return;
     }
 
@@ -904,43 +1250,109 @@ void parse_ay_file(const uint8_t* file, size_t size) {
     uint8_t first_song = file[17];
     int16_t p_song_structures = read_be16s(file + 18);
 
-    printf("file_version=%d\nplayer_version=%d\nnum_songs=%d first_song=%d\n", file_version, player_version, num_songs, first_song);
+    log_printf("file_version=%d\nplayer_version=%d\nnum_songs=%d first_song=%d\n", file_version, player_version, num_songs, first_song);
 
     size_t p_author_abs = (size_t)12 + p_author;
     size_t p_misc_abs = (size_t)14 + p_misc;
     if (p_author_abs < size) {
         author = read_ntstring(file, size, p_author_abs);
-        printf("Author: %s\n", author);
+        log_printf("Author: %s\n", author);
     }
     else
-        printf("Invalid author pointer\n");
+        log_printf("Invalid author pointer\n");
 
     if (p_misc_abs < size)
-        printf("Misc: %s\n", read_ntstring(file, size, p_misc_abs));
+        log_printf("Misc: %s\n", read_ntstring(file, size, p_misc_abs));
     else
-        printf("Invalid misc pointer\n");
+        log_printf("Invalid misc pointer\n");
+
+    if (index_entry) {
+        index_entry->file_version = file_version;
+        index_entry->player_version = player_version;
+        index_entry->first_song = first_song;
+        if (p_author_abs < size) index_entry->author = file_string(file, size, author);
+        if (p_misc_abs < size) index_entry->misc = file_string(file, size, read_ntstring(file, size, p_misc_abs));
+    }
 
     size_t p_song_structures_abs = static_cast<size_t>(18) + p_song_structures;
 
     parse_song_structure_table(file, size, p_song_structures_abs, num_songs);
 }
 
-// Main program entry point
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("Usage: %s file.ay\n", argv[0]);
+// Index one file (--index worker)
+static void index_file(const char* path, FileIndexEntry* entry) {
+    entry->path = path;
+    entry->status = INDEX_READ_ERROR;
+
+    FILE* f = fopen(path, "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* file = size > 0 ? (uint8_t*)malloc(size) : NULL;
+    int ok = file && fread(file, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok) {
+        free(file);
+        return;
+    }
+
+    entry->size = (uint64_t)size;
+    entry->hash = hash64(HASH64_SEED, file, size);
+    entry->status = (size >= 8 && memcmp(file, "ZXAYEMUL", 8) == 0) ? INDEX_OK : INDEX_NOT_AY;
+
+    log_quiet = 1;
+    index_entry = entry;
+    parse_ay_file(file, size);
+    index_entry = NULL;
+
+    free(file);
+}
+
+static int run_index(const char* index_path, const char* const* roots, int count) {
+    std::vector<std::string> paths;
+    if (ayindex_collect(roots, count, &paths) != 0 && paths.empty()) {
         return 1;
     }
 
-    int arg = 1;
-    FILE* f = fopen(argv[arg], "rb");
+    std::vector<FileIndexEntry> entries;
+    ayindex_build(paths, index_file, &entries);
+
+    size_t songs = 0, unreadable = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        songs += entries[i].songs.size();
+        if (entries[i].status == INDEX_READ_ERROR) unreadable++;
+    }
+    printf("Indexed %zu files, %zu songs (%zu unreadable)\n", entries.size(), songs, unreadable);
+
+    return ayindex_write(index_path, entries) == 0 ? 0 : 1;
+}
+
+// Convert all songs of a file already in memory, or only_song
+static void convert_data(const char* path, const uint8_t* file, size_t size) {
+    arena_reset(&song_arena);
+    orig_file_name = remove_file_extension(&song_arena, path);
+    file_mark = arena_mark(&song_arena);
+    input_path = path;
+
+    if (cache_dir) {
+        ay_file_hash = hash64(HASH64_SEED, file, size);
+    }
+
+    parse_ay_file(file, size);
+    orig_file_name = NULL;
+    input_path = NULL;
+}
+
+// Convert all songs of a file. Returns 0 on success.
+static int convert_file(const char* path) {
+    FILE* f = fopen(path, "rb");
     if (!f) {
         perror("Failed to open input file");
         return 1;
     }
 
-    orig_file_name = remove_file_extension(argv[arg]);
-
     fseek(f, 0, SEEK_END);
     size_t size = ftell(f);
     fseek(f, 0, SEEK_SET);
@@ -955,7 +1367,445 @@ int main(int argc, char** argv) {
     fread(file, 1, size, f);
     fclose(f);
 
-    parse_ay_file(file, size);
+    convert_data(path, file, size);
     free(file);
     return 0;
+}
+
+// Batch run options: the shard to convert (--shard i/N) and the list of
+// outputs written (--manifest) or compared with a stored one (--check),
+// filled by the workers
+static uint32_t shard_index = 0;
+static uint32_t shard_count = 1;
+static const char* manifest_path = NULL;
+static const char* check_path = NULL;
+static std::mutex manifest_mutex;
+static std::vector<ManifestEntry> manifest_entries;
+
+// Read a whole file into data. Returns 0 on success, -1 if it can't be read.
+static int read_file(const char* path, std::vector<uint8_t>* data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    data->clear();
+    uint8_t buffer[65536];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data->insert(data->end(), buffer, buffer + got);
+    }
+    int failed = ferror(f);
+    fclose(f);
+    return failed ? -1 : 0;
+}
+
+// Move this song's outputs from the scratch files into the pack
+static void pack_song_outputs(const BatchJob* job) {
+    std::vector<uint8_t> data;
+    for (int k = 0; k < output_format_count; k++) {
+        if (!output_files[k] || !pack_names[k] || read_file(output_files[k], &data) != 0) continue;
+        remove(output_files[k]);
+
+        const char* format = output_format_name(output_formats[k]);
+        pack_append(pack_writer, job->path.c_str(), job->song, pack_names[k], format, data.data(), data.size());
+
+        if (manifest_path || check_path) {
+            ManifestEntry entry;
+            entry.source = job->path;
+            entry.song = job->song;
+            entry.format = format;
+            entry.size = data.size();
+            entry.hash = hash64(HASH64_SEED, data.data(), data.size());
+            entry.output = pack_names[k];
+            std::lock_guard<std::mutex> lock(manifest_mutex);
+            manifest_entries.push_back(entry);
+        }
+    }
+}
+
+static void convert_job(const BatchJob* job, const uint8_t* data, size_t size) {
+    if (!data) {
+        printf("Failed to read %s\n", job->path.c_str());
+        return;
+    }
+
+    log_quiet = 1;
+    only_song = job->song;
+    convert_data(job->path.c_str(), data, size);
+
+    if (hash_only) {
+        // The song's frame stream stands in for its outputs
+        if (song_digest_valid && (manifest_path || check_path)) {
+            ManifestEntry entry;
+            entry.source = job->path;
+            entry.song = job->song;
+            entry.format = "frames";
+            entry.size = song_digest_frames;
+            entry.hash = song_digest;
+            entry.output = "-";
+            std::lock_guard<std::mutex> lock(manifest_mutex);
+            manifest_entries.push_back(entry);
+        }
+    }
+    else if (pack_writer) {
+        pack_song_outputs(job);
+    }
+    else if (manifest_path || check_path) {
+        // output_files still name this song's outputs; missing ones were
+        // empty or the song couldn't be converted
+        for (int k = 0; k < output_format_count; k++) {
+            ManifestEntry entry;
+            if (!output_files[k] || manifest_describe_output(job->path.c_str(), job->song,
+                output_format_name(output_formats[k]), output_files[k], &entry) != 0) continue;
+            std::lock_guard<std::mutex> lock(manifest_mutex);
+            manifest_entries.push_back(entry);
+        }
+    }
+
+    printf("Converted %s song %d (%u frames)\n", job->path.c_str(), job->song, job->cost);
+}
+
+static int is_directory(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+// Convert every song of the given files and directories on a worker pool,
+// longest songs first
+static int run_batch(const char* const* roots, int count, unsigned int workers) {
+    std::vector<std::string> paths;
+    if (ayindex_collect(roots, count, &paths) != 0 && paths.empty()) {
+        return 1;
+    }
+    if (shard_count > 1) {
+        batch_shard(&paths, roots, count, shard_index, shard_count);
+        printf("Shard %u of %u\n", shard_index, shard_count);
+    }
+
+    std::vector<FileIndexEntry> files;
+    ayindex_build(paths, index_file, &files);
+
+    std::vector<BatchJob> jobs;
+    batch_plan(files, &jobs);
+    batch_order_longest_first(&jobs);
+
+    uint64_t total_cost = 0;
+    for (size_t i = 0; i < jobs.size(); i++) total_cost += jobs[i].cost;
+    printf("Converting %zu songs from %zu files (%llu frames)\n",
+        jobs.size(), files.size(), (unsigned long long)total_cost);
+
+    PackWriter pack;
+    if (pack_path) {
+        if (pack_create(&pack, pack_path) != 0) return 1;
+        pack_writer = &pack;
+    }
+
+    batch_run(jobs, workers, convert_job);
+
+    if (pack_writer) {
+        pack_writer = NULL;
+        if (pack_close(&pack) != 0) return 1;
+    }
+    if (manifest_path && manifest_write(manifest_path, manifest_entries) != 0) {
+        return 1;
+    }
+    if (check_path) {
+        std::vector<ManifestEntry> expected;
+        if (manifest_read(check_path, &expected) != 0) return 1;
+        int differences = manifest_compare(expected, manifest_entries, stdout);
+        printf("Checked %zu outputs against %s: %d difference%s\n", manifest_entries.size(), check_path,
+            differences, differences == 1 ? "" : "s");
+        if (differences) return 1;
+    }
+    return 0;
+}
+
+// List a pack, or write some or all of its outputs as files
+static int run_extract(const char* path, const char* const* names, int count, int list_only) {
+    PackReader pack;
+    if (pack_open(&pack, path) != 0) return 1;
+
+    int failed = 0;
+    if (list_only) {
+        for (size_t i = 0; i < pack.entries.size(); i++) {
+            const PackEntry& e = pack.entries[i];
+            printf("%s\t%d\t%s\t%llu\t%s\n", e.source.c_str(), e.song, e.format.c_str(),
+                (unsigned long long)e.length, e.name.c_str());
+        }
+    }
+    else if (count == 0) {
+        for (size_t i = 0; i < pack.entries.size(); i++) {
+            if (pack_extract(&pack, (int)i) != 0) failed = 1;
+        }
+    }
+    else {
+        for (int i = 0; i < count; i++) {
+            int index = pack_find(&pack, names[i]);
+            if (index < 0) {
+                printf("'%s' is not in the pack\n", names[i]);
+                failed = 1;
+            }
+            else if (pack_extract(&pack, index) != 0) failed = 1;
+        }
+    }
+
+    pack_release(&pack);
+    return failed;
+}
+
+// Convert every input in turn on this thread, the way a single-file run
+// does, and report the throughput (--bench)
+static int run_bench(const char* const* roots, int count, const char* json_path) {
+    std::vector<std::string> paths;
+    if (ayindex_collect(roots, count, &paths) != 0 && paths.empty()) {
+        return 1;
+    }
+
+    // The per-song counters of --stats make up the totals
+    stats_enabled = 1;
+    log_quiet = 1;
+
+    BenchSummary summary = BenchSummary();
+    std::vector<uint8_t> data;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (read_file(paths[i].c_str(), &data) != 0) {
+            printf("Failed to read %s\n", paths[i].c_str());
+            continue;
+        }
+        convert_data(paths[i].c_str(), data.data(), data.size());
+        summary.files++;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    summary.seconds = elapsed.count();
+    for (size_t i = 0; i < run_stats.size(); i++) {
+        summary.songs++;
+        summary.frames += run_stats[i].frames;
+        summary.play_seconds += run_stats[i].play_seconds;
+        summary.cycles += run_stats[i].cycles;
+        summary.bytes_written += run_stats[i].bytes_written;
+    }
+    summary.peak_rss = bench_peak_rss();
+
+    bench_print(stdout, &summary);
+    if (json_path && bench_write_json(json_path, &summary) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// Main program entry point
+int main(int argc, char** argv) {
+    int arg = 1;
+    const char* index_path = NULL;
+    const char* merge_path = NULL;
+    const char* corpus_path = NULL;
+    const char* bench_json_path = NULL;
+    int bench_mode = 0;
+    int extract_mode = 0;
+    int jobs_option = -1;
+
+    // Options
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-f") == 0 && arg + 1 < argc) {
+            // Comma separated list, e.g. -f ym,vgm,psg
+            char* list = strdup(argv[++arg]);
+            output_format_count = 0;
+            for (char* name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+                OutputFormat format;
+                if (output_format_from_name(name, &format) != 0) {
+                    printf("Unknown output format '%s'\n", name);
+                    return 1;
+                }
+                for (int k = 0; k < output_format_count; k++) {
+                    if (strcmp(output_format_extension(output_formats[k]), output_format_extension(format)) == 0) {
+                        printf("Output formats '%s' and '%s' would write the same file\n",
+                            output_format_name(output_formats[k]), name);
+                        return 1;
+                    }
+                }
+                if (output_format_count == MAX_OUTPUTS) {
+                    printf("Too many output formats\n");
+                    return 1;
+                }
+                output_formats[output_format_count++] = format;
+            }
+            free(list);
+            if (output_format_count == 0) {
+                printf("No output format given\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--rate") == 0 && arg + 1 < argc) {
+            pcm_settings.sample_rate = (uint32_t)strtoul(argv[++arg], NULL, 10);
+            if (pcm_settings.sample_rate == 0) {
+                printf("Sample rate must be a positive number of Hz\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--machine") == 0 && arg + 1 < argc) {
+            const char* name = argv[++arg];
+            machine_override = strcmp(name, "auto") == 0 ? -1 : machine_profile_from_name(name);
+            if (machine_override < 0 && strcmp(name, "auto") != 0) {
+                printf("Unknown machine '%s'\n", name);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--detect") == 0 && arg + 1 < argc) {
+            const char* mode = argv[++arg];
+            if (strcmp(mode, "scan") == 0) probe_detection = 0;
+            else if (strcmp(mode, "probe") == 0) probe_detection = 1;
+            else {
+                printf("Unknown detection mode '%s'\n", mode);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--jobs") == 0 && arg + 1 < argc) {
+            jobs_option = atoi(argv[++arg]);
+            if (jobs_option < 0) jobs_option = 0;
+        }
+        else if (strcmp(argv[arg], "--shard") == 0 && arg + 1 < argc) {
+            if (sscanf(argv[++arg], "%u/%u", &shard_index, &shard_count) != 2 ||
+                shard_count == 0 || shard_index >= shard_count) {
+                printf("Shard must be given as i/N with 0 <= i < N\n");
+                return 1;
+            }
+            if (jobs_option < 0) jobs_option = 0;
+        }
+        else if (strcmp(argv[arg], "--manifest") == 0 && arg + 1 < argc) {
+            manifest_path = argv[++arg];
+            if (jobs_option < 0) jobs_option = 0;
+        }
+        else if (strcmp(argv[arg], "--check") == 0 && arg + 1 < argc) {
+            check_path = argv[++arg];
+            if (jobs_option < 0) jobs_option = 0;
+        }
+        else if (strcmp(argv[arg], "--hash-only") == 0) {
+            hash_only = 1;
+        }
+        else if (strcmp(argv[arg], "--pack") == 0 && arg + 1 < argc) {
+            pack_path = argv[++arg];
+            if (jobs_option < 0) jobs_option = 0;
+        }
+        else if (strcmp(argv[arg], "--extract") == 0 || strcmp(argv[arg], "--list") == 0) {
+            extract_mode = strcmp(argv[arg], "--list") == 0 ? 2 : 1;
+        }
+        else if (strcmp(argv[arg], "--merge") == 0 && arg + 1 < argc) {
+            merge_path = argv[++arg];
+        }
+#ifdef AY2YM_PROFILE
+        else if (strcmp(argv[arg], "--profile") == 0) {
+            profile_enabled = 1;
+        }
+#endif
+        else if (strcmp(argv[arg], "--stats") == 0) {
+            stats_enabled = 1;
+        }
+        else if (strcmp(argv[arg], "--stats-json") == 0 && arg + 1 < argc) {
+            stats_enabled = 1;
+            stats_json_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--make-corpus") == 0 && arg + 1 < argc) {
+            corpus_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--bench") == 0) {
+            bench_mode = 1;
+        }
+        else if (strcmp(argv[arg], "--bench-json") == 0 && arg + 1 < argc) {
+            bench_mode = 1;
+            bench_json_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--index") == 0 && arg + 1 < argc) {
+            index_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc) {
+            cache_dir = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--blep") == 0) {
+            pcm_settings.band_limited = 1;
+        }
+        else if (strcmp(argv[arg], "--stereo") == 0 && arg + 1 < argc) {
+            const char* layout = argv[++arg];
+            if (strcmp(layout, "abc") == 0) pcm_settings.layout = STEREO_ABC;
+            else if (strcmp(layout, "acb") == 0) pcm_settings.layout = STEREO_ACB;
+            else if (strcmp(layout, "mono") == 0) pcm_settings.layout = STEREO_MONO;
+            else {
+                printf("Unknown stereo layout '%s'\n", layout);
+                return 1;
+            }
+        }
+        else {
+            printf("Unknown option '%s'\n", argv[arg]);
+            return 1;
+        }
+        arg++;
+    }
+
+    if (hash_only) {
+        if (pack_path) {
+            printf("--hash-only writes no outputs to pack\n");
+            return 1;
+        }
+        // A dry run checks the emulation, so nothing comes from the caches
+        cache_dir = NULL;
+    }
+    if (check_path && shard_count > 1) {
+        printf("--check compares whole runs and can't be combined with --shard\n");
+        return 1;
+    }
+
+    if (corpus_path) {
+        int written = aycorpus_write(corpus_path);
+        if (written < 0) return 1;
+        printf("Wrote %d files to %s\n", written, corpus_path);
+        return 0;
+    }
+
+    if (arg >= argc) {
+        printf("Usage: %s [-f ym,lha,vgm,psg,regs,wav,pcm] [--rate hz] [--stereo abc|acb|mono] [--blep] [--machine auto|48k|128k|pentagon|cpc] [--detect scan|probe] [--cache dir] [--stats | --stats-json out.json] file.ay\n", argv[0]);
+        printf("       %s [options] [--jobs n] [--shard i/N] [--manifest out.txt] [--pack out.ayp] file.ay|dir...\n", argv[0]);
+        printf("       %s [options] --hash-only [--manifest golden.txt | --check golden.txt] file.ay|dir...\n", argv[0]);
+        printf("       %s --merge out.txt|out.ayp shard.txt|shard.ayp...\n", argv[0]);
+        printf("       %s --extract|--list pack.ayp [name...]\n", argv[0]);
+        printf("       %s --index out.json|out.bin file.ay|dir...\n", argv[0]);
+        printf("       %s --make-corpus dir\n", argv[0]);
+        printf("       %s [options] --bench [--bench-json out.json] file.ay|dir...\n", argv[0]);
+        return 1;
+    }
+
+    if (index_path) {
+        return run_index(index_path, argv + arg, argc - arg);
+    }
+
+    if (bench_mode) {
+        return run_bench(argv + arg, argc - arg, bench_json_path);
+    }
+
+    if (extract_mode) {
+        return run_extract(argv[arg], argv + arg + 1, argc - arg - 1, extract_mode == 2);
+    }
+
+    if (merge_path) {
+        if (pack_is_pack(argv[arg])) return pack_merge(merge_path, argv + arg, argc - arg) == 0 ? 0 : 1;
+        return manifest_merge(merge_path, argv + arg, argc - arg) == 0 ? 0 : 1;
+    }
+
+    // Several inputs or a directory make a batch run
+    if (jobs_option < 0 && (argc - arg > 1 || is_directory(argv[arg]))) {
+        jobs_option = 0;
+    }
+    std::chrono::steady_clock::time_point run_start = std::chrono::steady_clock::now();
+    int status = jobs_option >= 0
+        ? run_batch(argv + arg, argc - arg, (unsigned int)jobs_option)
+        : convert_file(argv[arg]);
+
+    if (stats_enabled) {
+        std::chrono::duration<double> run_time = std::chrono::steady_clock::now() - run_start;
+        if (stats_json_path) {
+            if (stats_write_json(stats_json_path, run_stats, run_time.count()) != 0) status = 1;
+        }
+        else {
+            stats_print(stderr, run_stats, run_time.count());
+        }
+    }
+    return status;
 }
\ No newline at end of file
@@ -6,6 +6,9 @@
 #define __AY2YM_INCLUDED__
 
 #include "z80emu.h"
+#ifdef AY2YM_PROFILE
+#include "profile.h"
+#endif
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -60,6 +63,10 @@ typedef struct {
     MachineType detected;
     int spectrum_port_count;
     int cpc_port_count;
+    int ula_port_count;       // OUT (n),A to the ULA (FE)
+    int undetected_port_count;    // OUT instructions that matched no machine
+    int block_count;          // blocks loaded and scanned
+    uint32_t block_bytes;
 } MachineDetectionResult;
 
 typedef struct AY2YM {
@@ -70,16 +77,45 @@ typedef struct AY2YM {
     uint8_t beeper;           // beeper state (bit 4)
     uint8_t is_done;          // emulation done flag
     uint8_t addr_latch;       // latched AY register index
+    uint8_t env_written;      // R13 written since last frame (envelope restart)
+
+    uint8_t machine;          // MachineProfileId the song runs on (machine.h)
 
     // CPC-specific state
     uint8_t CPCData;
     uint8_t CPCSwitch;
+
+    // AY registers written through each protocol this song, one bit each
+    // (machine probing)
+    uint16_t spectrum_regs;
+    uint16_t cpc_regs;
+
+    // Counters for --stats, reset for every song
+    uint64_t instructions;    // Z80 instructions executed
+    uint64_t ay_writes;       // writes to AY registers
+    uint32_t interrupts;      // interrupts accepted
+
+#ifdef AY2YM_PROFILE
+    struct Profiler* profiler;  // set while a song is profiled (--profile)
+#endif
 } AY2YM;
 
-const char* output_file = NULL;
-const char* orig_file_name = NULL;
-const char* song_name = NULL;
-const char* author = NULL;
+// CPU cycles the emulation loop runs between interrupt checks
+#define EMULATION_STEP_CYCLES 100
+
+// Where the emulation loop is within a song
+typedef struct EmulationPosition {
+    uint64_t cycles;          // CPU cycles run so far
+    uint64_t next_frame;      // cycle count of the next interrupt
+    uint32_t frames;          // frames produced so far
+} EmulationPosition;
+
+#ifdef __cplusplus
+// Names of the file and song being converted on this thread (defined in ay2ym.cpp)
+extern thread_local const char* orig_file_name;
+extern thread_local const char* song_name;
+extern thread_local const char* author;
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -91,6 +127,10 @@ extern void SystemCall(AY2YM* ay2ym);
 uint8_t ay2ym_in(void* context, uint16_t port, uint64_t elapsed_cycles);
 void ay2ym_out(void* context, uint16_t port, uint8_t value, uint64_t elapsed_cycles);
 
+// OTIR/OTDR: count bytes from data, stepping by step, all written to port
+void ay2ym_out_block(void* context, uint16_t port, const uint8_t* data, int count, int step,
+    uint64_t elapsed_cycles);
+
 #ifdef __cplusplus
 }
 #endif
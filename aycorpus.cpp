@@ -0,0 +1,395 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "aycorpus.h"
+#include "hash.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#else
+#define make_dir(path) mkdir((path), 0777)
+#endif
+
+#define SPECTRUM_ORG 0xC000
+#define CPC_ORG 0x8000
+#define PLAYER_STACK 0xF000
+#define IM2_TABLE 0xFE00      // 257 bytes of 0xFD: every vector reads 0xFDFD
+#define IM2_JUMP 0xFDFD
+#define ROW_SIZE 14           // registers 0-12, then R13 or 0xFF for none
+
+// The standard corpus: both port styles, every player kind, several songs
+// per file and song lengths up to 20 minutes
+static const CorpusFileSpec corpus_files[] = {
+    { "spectrum-im1.ay", CORPUS_SPECTRUM, CORPUS_IM1_HALT, 3, { 3000, 9000, 15000 } },
+    { "spectrum-im2.ay", CORPUS_SPECTRUM, CORPUS_IM2_HALT, 2, { 9000, 30000 } },
+    { "spectrum-busy.ay", CORPUS_SPECTRUM, CORPUS_BUSY_WAIT, 2, { 3000, 9000 } },
+    { "spectrum-long.ay", CORPUS_SPECTRUM, CORPUS_IM1_HALT, 1, { 60000 } },
+    { "spectrum-many.ay", CORPUS_SPECTRUM, CORPUS_IM1_HALT, 4, { 1500, 1500, 1500, 1500 } },
+    { "cpc-im1.ay", CORPUS_CPC, CORPUS_IM1_HALT, 3, { 3000, 9000, 15000 } },
+    { "cpc-im2.ay", CORPUS_CPC, CORPUS_IM2_HALT, 2, { 9000, 30000 } },
+    { "cpc-busy.ay", CORPUS_CPC, CORPUS_BUSY_WAIT, 2, { 3000, 9000 } },
+};
+
+//
+// Z80 assembly
+//
+
+typedef struct Assembler {
+    std::vector<uint8_t> code;
+    uint16_t org;
+} Assembler;
+
+static uint16_t here(const Assembler* a) {
+    return (uint16_t)(a->org + a->code.size());
+}
+
+static void emit(Assembler* a, const uint8_t* bytes, size_t count) {
+    a->code.insert(a->code.end(), bytes, bytes + count);
+}
+
+#define EMIT(a, ...) do { static const uint8_t bytes_[] = { __VA_ARGS__ }; emit((a), bytes_, sizeof(bytes_)); } while (0)
+
+static void emit8(Assembler* a, uint8_t value) {
+    a->code.push_back(value);
+}
+
+static void emit16(Assembler* a, uint16_t value) {
+    a->code.push_back((uint8_t)value);
+    a->code.push_back((uint8_t)(value >> 8));
+}
+
+// Fill in a 16-bit operand emitted before its value was known
+static void patch16(Assembler* a, uint16_t address, uint16_t value) {
+    a->code[address - a->org] = (uint8_t)value;
+    a->code[address - a->org + 1] = (uint8_t)(value >> 8);
+}
+
+// Relative jump opcode, displacement to target
+static void emit_jr(Assembler* a, uint8_t opcode, uint16_t target) {
+    emit8(a, opcode);
+    emit8(a, (uint8_t)(target - (here(a) + 1)));
+}
+
+// Forward relative jump, returns the displacement address for patch_jr
+static uint16_t emit_jr_forward(Assembler* a, uint8_t opcode) {
+    emit8(a, opcode);
+    emit8(a, 0);
+    return (uint16_t)(here(a) - 1);
+}
+
+static void patch_jr(Assembler* a, uint16_t displacement) {
+    a->code[displacement - a->org] = (uint8_t)(here(a) - (displacement + 1));
+}
+
+// AY register D = E. The redundant ld c,0xFD after each OUT is there for
+// load_blocks' static port scan, which reads the bytes following an
+// OUT (C),r as the port; it makes every write vote Spectrum.
+static void emit_write_spectrum(Assembler* a) {
+    EMIT(a, 0x01, 0xFD, 0xFF);    // ld bc,FFFDh
+    EMIT(a, 0xED, 0x51);          // out (c),d
+    EMIT(a, 0x0E, 0xFD);          // ld c,FDh
+    EMIT(a, 0x06, 0xBF);          // ld b,BFh
+    EMIT(a, 0xED, 0x59);          // out (c),e
+    EMIT(a, 0x0E, 0xFD);          // ld c,FDh
+    EMIT(a, 0xC9);                // ret
+}
+
+// AY register D = E through the PPI: register number on port A, select,
+// inactive, value on port A, write, inactive
+static void emit_write_cpc(Assembler* a) {
+    EMIT(a, 0x01, 0x00, 0xF4);    // ld bc,F400h
+    EMIT(a, 0xED, 0x51);          // out (c),d
+    EMIT(a, 0x3E, 0xC0);          // ld a,C0h
+    EMIT(a, 0x06, 0xF6);          // ld b,F6h
+    EMIT(a, 0xED, 0x79);          // out (c),a
+    EMIT(a, 0xAF);                // xor a
+    EMIT(a, 0xED, 0x79);          // out (c),a
+    EMIT(a, 0x06, 0xF4);          // ld b,F4h
+    EMIT(a, 0xED, 0x59);          // out (c),e
+    EMIT(a, 0x06, 0xF6);          // ld b,F6h
+    EMIT(a, 0x3E, 0x80);          // ld a,80h
+    EMIT(a, 0xED, 0x79);          // out (c),a
+    EMIT(a, 0xAF);                // xor a
+    EMIT(a, 0xED, 0x79);          // out (c),a
+    EMIT(a, 0xC9);                // ret
+}
+
+// Deterministic register rows for one song
+static uint32_t next_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void emit_rows(Assembler* a, uint32_t seed, int rows) {
+    uint32_t state = seed ? seed : 1;
+    for (int r = 0; r < rows; r++) {
+        uint8_t row[ROW_SIZE];
+        for (int channel = 0; channel < 3; channel++) {
+            row[channel * 2] = (uint8_t)next_random(&state);
+            row[channel * 2 + 1] = (uint8_t)(next_random(&state) & 0x03);
+        }
+        row[6] = (uint8_t)(next_random(&state) & 0x1F);
+        row[7] = (uint8_t)(0x38 & ~((next_random(&state) & 3) == 0 ? 0x20 : 0));
+        for (int channel = 0; channel < 3; channel++) {
+            uint32_t v = next_random(&state);
+            row[8 + channel] = (v & 0xF0) == 0 ? 0x10 : (uint8_t)(v & 0x0F);
+        }
+        row[11] = (uint8_t)next_random(&state);
+        row[12] = (uint8_t)(next_random(&state) & 0x0F);
+        uint32_t shape = next_random(&state);
+        row[13] = (shape & 7) == 0 ? (uint8_t)(0x08 + ((shape >> 3) & 7)) : 0xFF;
+        emit(a, row, sizeof(row));
+    }
+}
+
+typedef struct SongCode {
+    std::vector<uint8_t> block;
+    uint16_t org;
+    uint16_t init;
+    uint16_t interrupt;       // 0 when init sets up its own interrupts
+} SongCode;
+
+static void assemble_song(const CorpusFileSpec* spec, uint32_t seed, SongCode* song) {
+    Assembler a;
+    a.org = spec->ports == CORPUS_CPC ? CPC_ORG : SPECTRUM_ORG;
+
+    // Variables: row pointer and the busy-wait frame flag
+    uint16_t ptr = here(&a);
+    emit16(&a, 0);
+    uint16_t flag = here(&a);
+    emit8(&a, 0);
+
+    uint16_t write_reg = here(&a);
+    if (spec->ports == CORPUS_CPC) emit_write_cpc(&a);
+    else emit_write_spectrum(&a);
+
+    // play: write registers 0-12 from the current row, R13 unless 0xFF,
+    // then move to the next row, wrapping at the end of the table
+    uint16_t play = here(&a);
+    EMIT(&a, 0x2A); emit16(&a, ptr);          // ld hl,(ptr)
+    EMIT(&a, 0x16, 0x00);                     // ld d,0
+    uint16_t loop = here(&a);
+    EMIT(&a, 0x5E);                           // ld e,(hl)
+    EMIT(&a, 0xCD); emit16(&a, write_reg);    // call write_reg
+    EMIT(&a, 0x23);                           // inc hl
+    EMIT(&a, 0x14);                           // inc d
+    EMIT(&a, 0x7A);                           // ld a,d
+    EMIT(&a, 0xFE, 0x0D);                     // cp 13
+    emit_jr(&a, 0x20, loop);                  // jr nz,loop
+    EMIT(&a, 0x7E);                           // ld a,(hl)
+    EMIT(&a, 0x23);                           // inc hl
+    EMIT(&a, 0xFE, 0xFF);                     // cp FFh
+    uint16_t no_shape = emit_jr_forward(&a, 0x28);    // jr z,next
+    EMIT(&a, 0x5F);                           // ld e,a
+    EMIT(&a, 0xCD); emit16(&a, write_reg);    // call write_reg
+    patch_jr(&a, no_shape);
+    EMIT(&a, 0x11);                           // ld de,table_end
+    uint16_t table_end_ref = here(&a);
+    emit16(&a, 0);
+    EMIT(&a, 0xB7);                           // or a
+    EMIT(&a, 0xED, 0x52);                     // sbc hl,de
+    EMIT(&a, 0x19);                           // add hl,de
+    uint16_t no_wrap = emit_jr_forward(&a, 0x20);     // jr nz,store
+    EMIT(&a, 0x21);                           // ld hl,table
+    uint16_t table_ref_play = here(&a);
+    emit16(&a, 0);
+    patch_jr(&a, no_wrap);
+    EMIT(&a, 0x22); emit16(&a, ptr);          // store: ld (ptr),hl
+    EMIT(&a, 0xC9);                           // ret
+
+    uint16_t init = here(&a);
+    EMIT(&a, 0x21);                           // ld hl,table
+    uint16_t table_ref_init = here(&a);
+    emit16(&a, 0);
+    EMIT(&a, 0x22); emit16(&a, ptr);          // ld (ptr),hl
+
+    uint16_t interrupt = 0;
+    uint16_t handler_ref = 0;
+    uint16_t handler = 0;
+    static const uint8_t handler_code[] = {
+        0xF5,                                 // push af
+        0x3E, 0x01,                           // ld a,1
+        0x32, 0x00, 0x00,                     // ld (flag),a
+        0xF1,                                 // pop af
+        0xFB,                                 // ei
+        0xC9,                                 // ret
+    };
+
+    switch (spec->player) {
+    case CORPUS_IM1_HALT:
+        EMIT(&a, 0xC9);                       // ret
+        interrupt = play;
+        break;
+    case CORPUS_IM2_HALT:
+        // The AY stub does im 2, ei, halt once init returns
+        EMIT(&a, 0x21); emit16(&a, IM2_TABLE);        // ld hl,IM2_TABLE
+        EMIT(&a, 0x11); emit16(&a, IM2_TABLE + 1);    // ld de,IM2_TABLE+1
+        EMIT(&a, 0x01); emit16(&a, 256);              // ld bc,256
+        EMIT(&a, 0x36, 0xFD);                         // ld (hl),FDh
+        EMIT(&a, 0xED, 0xB0);                         // ldir
+        EMIT(&a, 0x3E, 0xC3);                         // ld a,C3h (jp)
+        EMIT(&a, 0x32); emit16(&a, IM2_JUMP);         // ld (IM2_JUMP),a
+        EMIT(&a, 0x21); emit16(&a, play);             // ld hl,play
+        EMIT(&a, 0x22); emit16(&a, IM2_JUMP + 1);     // ld (IM2_JUMP+1),hl
+        EMIT(&a, 0x3E, IM2_TABLE >> 8);               // ld a,FEh
+        EMIT(&a, 0xED, 0x47);                         // ld i,a
+        EMIT(&a, 0xC9);                               // ret
+        break;
+    case CORPUS_BUSY_WAIT: {
+        // Install an IM 1 handler that raises the flag, then poll it forever
+        EMIT(&a, 0x21);                               // ld hl,handler
+        handler_ref = here(&a);
+        emit16(&a, 0);
+        EMIT(&a, 0x11); emit16(&a, 0x0038);           // ld de,0038h
+        EMIT(&a, 0x01); emit16(&a, sizeof(handler_code));   // ld bc,size
+        EMIT(&a, 0xED, 0xB0);                         // ldir
+        EMIT(&a, 0xED, 0x56);                         // im 1
+        EMIT(&a, 0xFB);                               // ei
+        uint16_t wait = here(&a);
+        EMIT(&a, 0x3A); emit16(&a, flag);             // ld a,(flag)
+        EMIT(&a, 0xB7);                               // or a
+        emit_jr(&a, 0x28, wait);                      // jr z,wait
+        EMIT(&a, 0xAF);                               // xor a
+        EMIT(&a, 0x32); emit16(&a, flag);             // ld (flag),a
+        EMIT(&a, 0xCD); emit16(&a, play);             // call play
+        emit_jr(&a, 0x18, wait);                      // jr wait
+        handler = here(&a);
+        emit(&a, handler_code, sizeof(handler_code));
+        patch16(&a, handler + 4, flag);
+        patch16(&a, handler_ref, handler);
+        break;
+    }
+    }
+
+    uint16_t table = here(&a);
+    emit_rows(&a, seed, 32 + (int)(seed % 97));
+    uint16_t table_end = here(&a);
+    patch16(&a, table_end_ref, table_end);
+    patch16(&a, table_ref_play, table);
+    patch16(&a, table_ref_init, table);
+
+    song->block.swap(a.code);
+    song->org = a.org;
+    song->init = init;
+    song->interrupt = interrupt;
+}
+
+//
+// AY file layout
+//
+
+static void put_be16(std::vector<uint8_t>* f, size_t at, uint16_t value) {
+    (*f)[at] = (uint8_t)(value >> 8);
+    (*f)[at + 1] = (uint8_t)value;
+}
+
+// Relative pointer at `at` to `target`
+static void put_rel(std::vector<uint8_t>* f, size_t at, size_t target) {
+    put_be16(f, at, (uint16_t)(int16_t)((long)target - (long)at));
+}
+
+static size_t append_zeros(std::vector<uint8_t>* f, size_t count) {
+    size_t at = f->size();
+    f->resize(at + count, 0);
+    return at;
+}
+
+static size_t append_string(std::vector<uint8_t>* f, const char* text) {
+    size_t at = f->size();
+    f->insert(f->end(), text, text + strlen(text) + 1);
+    return at;
+}
+
+void aycorpus_build(const CorpusFileSpec* spec, std::vector<uint8_t>* out) {
+    static const char* const player_names[] = { "IM 1 player", "IM 2 player", "busy-wait player" };
+    std::vector<uint8_t>& f = *out;
+    f.clear();
+
+    append_zeros(&f, 20);
+    memcpy(f.data(), "ZXAYEMUL", 8);
+    f[8] = 3;                 // file version
+    f[9] = 0;                 // player version
+    f[16] = (uint8_t)(spec->song_count - 1);
+    f[17] = 0;                // first song
+
+    put_rel(&f, 12, append_string(&f, "ay2ym corpus"));
+    char misc[64];
+    snprintf(misc, sizeof(misc), "%s ports, %s",
+        spec->ports == CORPUS_CPC ? "CPC" : "Spectrum", player_names[spec->player]);
+    put_rel(&f, 14, append_string(&f, misc));
+
+    size_t table = append_zeros(&f, 4 * (size_t)spec->song_count);
+    put_rel(&f, 18, table);
+
+    uint64_t name_hash = hash64(HASH64_SEED, spec->name, strlen(spec->name));
+    for (int s = 0; s < spec->song_count; s++) {
+        SongCode song;
+        assemble_song(spec, (uint32_t)hash64_u32(name_hash, (uint32_t)s), &song);
+
+        char name[32];
+        snprintf(name, sizeof(name), "Song %d", s + 1);
+        put_rel(&f, table + 4 * s, append_string(&f, name));
+
+        size_t data = append_zeros(&f, 14);
+        put_rel(&f, table + 4 * s + 2, data);
+        f[data + 0] = 0;      // channel mapping A, B, C, noise
+        f[data + 1] = 1;
+        f[data + 2] = 2;
+        f[data + 3] = 3;
+        put_be16(&f, data + 4, spec->lengths[s]);
+        put_be16(&f, data + 6, 0);    // fade length
+        f[data + 8] = 0;      // hi_reg
+        f[data + 9] = 0;      // lo_reg
+
+        size_t points = append_zeros(&f, 6);
+        put_rel(&f, data + 10, points);
+        put_be16(&f, points, PLAYER_STACK);
+        put_be16(&f, points + 2, song.init);
+        put_be16(&f, points + 4, song.interrupt);
+
+        // One block, then the terminating zero address
+        size_t addresses = append_zeros(&f, 8);
+        put_rel(&f, data + 12, addresses);
+        put_be16(&f, addresses, song.org);
+        put_be16(&f, addresses + 2, (uint16_t)song.block.size());
+        size_t block = f.size();
+        f.insert(f.end(), song.block.begin(), song.block.end());
+        put_rel(&f, addresses + 4, block);
+    }
+}
+
+int aycorpus_write(const char* dir) {
+    if (make_dir(dir) != 0 && errno != EEXIST) {
+        printf("Can't create corpus directory '%s'\n", dir);
+        return -1;
+    }
+
+    int written = 0;
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < sizeof(corpus_files) / sizeof(corpus_files[0]); i++) {
+        aycorpus_build(&corpus_files[i], &data);
+
+        std::string path = std::string(dir) + "/" + corpus_files[i].name;
+        FILE* out = fopen(path.c_str(), "wb");
+        if (!out) {
+            printf("Can't create '%s'\n", path.c_str());
+            return -1;
+        }
+        int failed = fwrite(data.data(), 1, data.size(), out) != data.size();
+        if (fclose(out) != 0) failed = 1;
+        if (failed) {
+            printf("Failed to write '%s'\n", path.c_str());
+            return -1;
+        }
+        written++;
+    }
+    return written;
+}
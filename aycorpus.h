@@ -0,0 +1,47 @@
+/* aycorpus.h
+ * Synthetic AY files for benchmarking (--make-corpus).
+ *
+ * Every file carries small assembled Z80 players: the register writes use
+ * either Spectrum (FFFD/BFFD) or CPC (PPI on F4xx/F6xx) ports, and the
+ * player is called from the IM 1 stub at each HALT, from an IM 2 vector
+ * table set up by init, or from a busy-wait main loop that polls a flag set
+ * by the IM 1 handler and never returns. Songs step through pseudo-random
+ * register rows; everything is derived from fixed seeds, so the corpus is
+ * byte-identical on every machine and run.
+ */
+
+#ifndef __AYCORPUS_INCLUDED__
+#define __AYCORPUS_INCLUDED__
+
+#include <stdint.h>
+#include <vector>
+
+#define CORPUS_MAX_SONGS 4
+
+typedef enum {
+    CORPUS_SPECTRUM = 0,
+    CORPUS_CPC
+} CorpusPorts;
+
+typedef enum {
+    CORPUS_IM1_HALT = 0,      // interrupt routine called by the AY stub
+    CORPUS_IM2_HALT,          // init installs an IM 2 table and returns
+    CORPUS_BUSY_WAIT          // init polls a frame flag forever
+} CorpusPlayer;
+
+typedef struct CorpusFileSpec {
+    const char* name;
+    CorpusPorts ports;
+    CorpusPlayer player;
+    int song_count;
+    uint16_t lengths[CORPUS_MAX_SONGS];   // frames per song
+} CorpusFileSpec;
+
+// Assemble the AY file described by spec into out
+void aycorpus_build(const CorpusFileSpec* spec, std::vector<uint8_t>* out);
+
+// Write the standard corpus into dir (created if missing). Returns the
+// number of files written, -1 on failure.
+int aycorpus_write(const char* dir);
+
+#endif
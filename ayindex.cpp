@@ -0,0 +1,208 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "ayindex.h"
+#include "ay2ym.h"
+#include "serialize.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+static int is_directory(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static int has_ay_extension(const char* name) {
+    size_t length = strlen(name);
+    if (length < 3) return 0;
+    const char* ext = name + length - 3;
+    return ext[0] == '.' && (ext[1] == 'a' || ext[1] == 'A') && (ext[2] == 'y' || ext[2] == 'Y');
+}
+
+static int collect_directory(const std::string& dir, std::vector<std::string>* paths) {
+#ifdef _WIN32
+    struct _finddata_t found;
+    intptr_t handle = _findfirst((dir + "\\*").c_str(), &found);
+    if (handle == -1) return -1;
+    do {
+        const char* name = found.name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        std::string path = dir + "\\" + name;
+        if (found.attrib & _A_SUBDIR) collect_directory(path, paths);
+        else if (has_ay_extension(name)) paths->push_back(path);
+    } while (_findnext(handle, &found) == 0);
+    _findclose(handle);
+#else
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) return -1;
+    for (struct dirent* item = readdir(handle); item; item = readdir(handle)) {
+        const char* name = item->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        std::string path = dir + "/" + name;
+        if (is_directory(path.c_str())) collect_directory(path, paths);
+        else if (has_ay_extension(name)) paths->push_back(path);
+    }
+    closedir(handle);
+#endif
+    return 0;
+}
+
+int ayindex_collect(const char* const* roots, int count, std::vector<std::string>* paths) {
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (!is_directory(roots[i])) {
+            paths->push_back(roots[i]);
+        }
+        else if (collect_directory(roots[i], paths) != 0) {
+            printf("Can't read directory '%s'\n", roots[i]);
+            failed = -1;
+        }
+    }
+    std::sort(paths->begin(), paths->end());
+    return failed;
+}
+
+void ayindex_build(const std::vector<std::string>& paths, IndexFileFunc index_file,
+    std::vector<FileIndexEntry>* entries)
+{
+    entries->assign(paths.size(), FileIndexEntry());
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next.fetch_add(1); i < paths.size(); i = next.fetch_add(1)) {
+            index_file(paths[i].c_str(), &(*entries)[i]);
+        }
+    };
+
+    unsigned int threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (threads > paths.size()) threads = (unsigned int)paths.size();
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; i++) workers.emplace_back(worker);
+    worker();
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+//
+// JSON
+//
+
+static const char* machine_name(uint8_t machine) {
+    switch (machine) {
+    case MACHINE_ZX_SPECTRUM: return "spectrum";
+    case MACHINE_AMSTRAD_CPC: return "cpc";
+    default: return "unknown";
+    }
+}
+
+static void write_json(FILE* out, const std::vector<FileIndexEntry>& entries) {
+    static const char* const status_names[] = { "ok", "not_ay", "read_error" };
+    static const char* const length_names[] = { "header", "address_table", "default" };
+
+    fprintf(out, "{\"version\":%d,\"files\":[", AYINDEX_VERSION);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const FileIndexEntry& e = entries[i];
+        fprintf(out, "%s\n{\"path\":", i ? "," : "");
+        json_string(out, e.path);
+        fprintf(out, ",\"size\":%llu,\"hash\":\"%016llx\",\"status\":\"%s\"",
+            (unsigned long long)e.size, (unsigned long long)e.hash, status_names[e.status]);
+        if (e.status == INDEX_READ_ERROR) {
+            fprintf(out, "}");
+            continue;
+        }
+        fprintf(out, ",\"file_version\":%u,\"player_version\":%u,\"first_song\":%u,\"author\":",
+            e.file_version, e.player_version, e.first_song);
+        json_string(out, e.author);
+        fprintf(out, ",\"misc\":");
+        json_string(out, e.misc);
+        fprintf(out, ",\"songs\":[");
+        for (size_t k = 0; k < e.songs.size(); k++) {
+            const SongIndexEntry& s = e.songs[k];
+            fprintf(out, "%s\n {\"index\":%d,\"name\":", k ? "," : "", s.index);
+            json_string(out, s.name);
+            fprintf(out, ",\"length\":%u,\"fade\":%u,\"length_source\":\"%s\"",
+                s.song_length, s.fade_length, length_names[s.length_source]);
+            if (s.has_points) {
+                fprintf(out, ",\"stack\":%u,\"init\":%u,\"interrupt\":%u,\"machine\":\"%s\","
+                    "\"spectrum_ports\":%u,\"cpc_ports\":%u,\"blocks\":%u,\"block_bytes\":%u",
+                    s.stack, s.init, s.interrupt, machine_name(s.machine),
+                    s.spectrum_ports, s.cpc_ports, s.block_count, s.block_bytes);
+                if (!s.player.empty()) {
+                    fprintf(out, ",\"player\":");
+                    json_string(out, s.player);
+                }
+            }
+            fprintf(out, "}");
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n]}\n");
+}
+
+//
+// Binary
+//
+
+static void write_binary(FILE* out, const std::vector<FileIndexEntry>& entries) {
+    std::vector<uint8_t> data;
+    data.insert(data.end(), { 'A', 'Y', 'I', 'X' });
+    put_u32(data, AYINDEX_VERSION);
+    put_u32(data, (uint32_t)entries.size());
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const FileIndexEntry& e = entries[i];
+        put_string(data, e.path);
+        put_u64(data, e.size);
+        put_u64(data, e.hash);
+        put_u8(data, e.status);
+        put_u8(data, e.file_version);
+        put_u8(data, e.player_version);
+        put_u8(data, e.first_song);
+        put_string(data, e.author);
+        put_string(data, e.misc);
+        put_u16(data, (uint32_t)e.songs.size());
+        for (size_t k = 0; k < e.songs.size(); k++) {
+            const SongIndexEntry& s = e.songs[k];
+            put_string(data, s.name);
+            put_u16(data, s.song_length);
+            put_u16(data, s.fade_length);
+            put_u8(data, s.length_source);
+            put_u8(data, s.has_points);
+            put_u16(data, s.stack);
+            put_u16(data, s.init);
+            put_u16(data, s.interrupt);
+            put_u8(data, s.machine);
+            put_u16(data, s.spectrum_ports);
+            put_u16(data, s.cpc_ports);
+            put_u16(data, s.block_count);
+            put_u32(data, s.block_bytes);
+            put_string(data, s.player);
+        }
+    }
+    fwrite(data.data(), 1, data.size(), out);
+}
+
+int ayindex_write(const char* path, const std::vector<FileIndexEntry>& entries) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        printf("Can't open index file '%s'\n", path);
+        return -1;
+    }
+
+    size_t length = strlen(path);
+    if (length >= 5 && strcmp(path + length - 5, ".json") == 0) write_json(out, entries);
+    else write_binary(out, entries);
+
+    int failed = ferror(out) != 0;
+    if (fclose(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
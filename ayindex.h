@@ -0,0 +1,84 @@
+/* ayindex.h
+ * Header-only index of an AY collection (--index).
+ *
+ * Files are found by walking directories, parsed on all cores without
+ * emulating anything, and written as JSON (.json) or as a compact binary
+ * index (any other name), in path order so the output is reproducible.
+ *
+ * Binary layout, integers little endian, strings as u16 length + bytes:
+ *   "AYIX", u32 version, u32 file count, then per file:
+ *   path, u64 size, u64 content hash, u8 status, u8 file version,
+ *   u8 player version, u8 first song, author, misc, u16 song count,
+ *   then per song: name, u16 song length, u16 fade length, u8 length
+ *   source, u8 has points, u16 stack, u16 init, u16 interrupt,
+ *   u8 machine, u16 spectrum ports, u16 cpc ports, u16 blocks,
+ *   u32 block bytes, player (empty if not recognised).
+ */
+
+#ifndef __AYINDEX_INCLUDED__
+#define __AYINDEX_INCLUDED__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define AYINDEX_VERSION 2
+
+typedef enum {
+    LENGTH_HEADER = 0,        // song_length from the song data
+    LENGTH_ADDRESS_TABLE,     // estimated from the address table
+    LENGTH_DEFAULT            // nothing usable, 5 minute default
+} LengthSource;
+
+typedef enum {
+    INDEX_OK = 0,
+    INDEX_NOT_AY,             // no ZXAYEMUL signature (parsed anyway)
+    INDEX_READ_ERROR
+} IndexStatus;
+
+typedef struct SongIndexEntry {
+    int index;
+    std::string name;
+    uint16_t song_length;     // frames, after deriving a missing length
+    uint16_t fade_length;
+    uint8_t length_source;    // LengthSource
+    uint8_t has_points;
+    uint16_t stack;
+    uint16_t init;
+    uint16_t interrupt;
+    uint8_t machine;          // MachineType from the static port scan
+    uint16_t spectrum_ports;
+    uint16_t cpc_ports;
+    uint16_t block_count;
+    uint32_t block_bytes;
+    std::string player;       // known player (players.h), empty if not recognised
+} SongIndexEntry;
+
+typedef struct FileIndexEntry {
+    std::string path;
+    uint64_t size;
+    uint64_t hash;            // hash64 of the file bytes
+    uint8_t status;           // IndexStatus
+    uint8_t file_version;
+    uint8_t player_version;
+    uint8_t first_song;
+    std::string author;
+    std::string misc;
+    std::vector<SongIndexEntry> songs;
+} FileIndexEntry;
+
+// Parses one file into entry, provided by the converter
+typedef void (*IndexFileFunc)(const char* path, FileIndexEntry* entry);
+
+// Add every .ay file under the given files or directories, sorted by path.
+// Returns 0 on success, -1 if a root can't be read.
+int ayindex_collect(const char* const* roots, int count, std::vector<std::string>* paths);
+
+// Index all paths using one worker per core
+void ayindex_build(const std::vector<std::string>& paths, IndexFileFunc index_file,
+    std::vector<FileIndexEntry>* entries);
+
+// Returns 0 on success, -1 on failure
+int ayindex_write(const char* path, const std::vector<FileIndexEntry>& entries);
+
+#endif
@@ -0,0 +1,630 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "aysynth.h"
+#include <algorithm>
+#include <complex>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Pick the widest vector unit the compiler targets. The x64 ABI always has SSE2.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AYSYNTH_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AYSYNTH_SSE2
+#endif
+
+#if defined(AYSYNTH_AVX2)
+#define VLANES 8
+typedef __m256 vfloat;
+#define vset1(x)      _mm256_set1_ps(x)
+#define vload(p)      _mm256_loadu_ps(p)
+#define vstore(p, x)  _mm256_storeu_ps((p), (x))
+#define vadd(a, b)    _mm256_add_ps((a), (b))
+#define vsub(a, b)    _mm256_sub_ps((a), (b))
+#define vmul(a, b)    _mm256_mul_ps((a), (b))
+#define vmin(a, b)    _mm256_min_ps((a), (b))
+#define vmax(a, b)    _mm256_max_ps((a), (b))
+#define vfloor(x)     _mm256_floor_ps(x)
+#define vramp()       _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)
+#elif defined(AYSYNTH_SSE2)
+#define VLANES 4
+typedef __m128 vfloat;
+#define vset1(x)      _mm_set1_ps(x)
+#define vload(p)      _mm_loadu_ps(p)
+#define vstore(p, x)  _mm_storeu_ps((p), (x))
+#define vadd(a, b)    _mm_add_ps((a), (b))
+#define vsub(a, b)    _mm_sub_ps((a), (b))
+#define vmul(a, b)    _mm_mul_ps((a), (b))
+#define vmin(a, b)    _mm_min_ps((a), (b))
+#define vmax(a, b)    _mm_max_ps((a), (b))
+#define vfloor(x)     _mm_cvtepi32_ps(_mm_cvttps_epi32(x))    // x >= 0
+#define vramp()       _mm_setr_ps(0, 1, 2, 3)
+#else
+#define VLANES 1
+typedef float vfloat;
+#define vset1(x)      (x)
+#define vload(p)      (*(p))
+#define vstore(p, x)  (*(p) = (x))
+#define vadd(a, b)    ((a) + (b))
+#define vsub(a, b)    ((a) - (b))
+#define vmul(a, b)    ((a) * (b))
+#define vmin(a, b)    ((a) < (b) ? (a) : (b))
+#define vmax(a, b)    ((a) > (b) ? (a) : (b))
+#define vfloor(x)     ((float)(int)(x))                       // x >= 0
+#define vramp()       (0.0f)
+#endif
+
+// Scratch buffers are rounded up so vector loops never need a scalar tail
+#define PADDED(n) ((((n) + VLANES) / VLANES + 1) * VLANES)
+
+// AY-3-8910 DAC output levels, normalised to 1.0
+static const float dac_table[16] = {
+    0.0f, 0.00999465934234f, 0.0144502937362f, 0.0210574502174f,
+    0.0307011520562f, 0.0455481803616f, 0.0644998855573f, 0.107362478065f,
+    0.126588845655f, 0.20498970016f, 0.292210269322f, 0.372838941024f,
+    0.492530708782f, 0.635324635691f, 0.805584802014f, 1.0f
+};
+
+// Envelope shapes as two segments; the generator alternates between them
+// until it reaches a hold segment.
+typedef enum { ENV_DOWN, ENV_UP, ENV_HOLD_BOTTOM, ENV_HOLD_TOP } EnvSegment;
+
+static const uint8_t env_shapes[16][2] = {
+    { ENV_DOWN, ENV_HOLD_BOTTOM }, { ENV_DOWN, ENV_HOLD_BOTTOM },
+    { ENV_DOWN, ENV_HOLD_BOTTOM }, { ENV_DOWN, ENV_HOLD_BOTTOM },
+    { ENV_UP, ENV_HOLD_BOTTOM },   { ENV_UP, ENV_HOLD_BOTTOM },
+    { ENV_UP, ENV_HOLD_BOTTOM },   { ENV_UP, ENV_HOLD_BOTTOM },
+    { ENV_DOWN, ENV_DOWN },        { ENV_DOWN, ENV_HOLD_BOTTOM },
+    { ENV_DOWN, ENV_UP },          { ENV_DOWN, ENV_HOLD_TOP },
+    { ENV_UP, ENV_UP },            { ENV_UP, ENV_HOLD_TOP },
+    { ENV_UP, ENV_DOWN },          { ENV_UP, ENV_HOLD_BOTTOM }
+};
+
+static void env_reset_segment(AySynthState* st) {
+    uint8_t seg = env_shapes[st->env_shape][st->env_segment];
+    st->env_level = (seg == ENV_DOWN || seg == ENV_HOLD_TOP) ? 15 : 0;
+}
+
+static void env_step(AySynthState* st) {
+    switch (env_shapes[st->env_shape][st->env_segment]) {
+    case ENV_DOWN:
+        if (--st->env_level < 0) {
+            st->env_segment ^= 1;
+            env_reset_segment(st);
+        }
+        break;
+    case ENV_UP:
+        if (++st->env_level > 15) {
+            st->env_segment ^= 1;
+            env_reset_segment(st);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void noise_step(AySynthState* st) {
+    uint32_t bit = (st->noise_lfsr ^ (st->noise_lfsr >> 3)) & 1;
+    st->noise_lfsr = (st->noise_lfsr >> 1) | (bit << 16);
+}
+
+// Length and periods of the current frame in time units
+typedef struct FrameParams {
+    int samples;
+    uint64_t tone_period[3];
+    uint64_t noise_period;
+    uint64_t env_period;
+} FrameParams;
+
+// Latch the frame's registers. A counter already past a shortened period
+// wraps immediately, as the chip's >= compare would on the next tick.
+static void apply_registers(AySynth* synth, const uint8_t* regs, int env_written, FrameParams* fp) {
+    AySynthState* st = &synth->state;
+    const uint64_t tick = synth->tick_units;
+
+    // A frame starts on the last sample at or before its exact start
+    uint64_t phase = st->frame_phase + synth->frame_length;
+    fp->samples = (int)(phase / synth->cpu_clock);
+    st->frame_phase = phase % synth->cpu_clock;
+
+    for (int c = 0; c < 3; c++) {
+        uint32_t period = regs[c * 2] | ((regs[c * 2 + 1] & 0x0F) << 8);
+        fp->tone_period[c] = (period ? period : 1) * tick;
+        if (st->tone_counter[c] >= fp->tone_period[c]) {
+            st->tone_counter[c] = 0;
+            st->tone_bit[c] ^= 1;
+        }
+    }
+
+    uint32_t noise_period = regs[6] & 0x1F;
+    fp->noise_period = 2 * (uint64_t)(noise_period ? noise_period : 1) * tick;
+    if (st->noise_counter >= fp->noise_period) {
+        st->noise_counter = 0;
+        noise_step(st);
+    }
+
+    uint32_t env_period = regs[11] | (regs[12] << 8);
+    fp->env_period = 2 * (uint64_t)(env_period ? env_period : 1) * tick;
+    if (env_written) {
+        st->env_shape = regs[13] & 0x0F;
+        st->env_segment = 0;
+        st->env_counter = 0;
+        env_reset_segment(st);
+    }
+    else if (st->env_counter >= fp->env_period) {
+        st->env_counter = 0;
+        env_step(st);
+    }
+}
+
+// Move tone counters to the end of the frame
+static void advance_tones(AySynth* synth, const FrameParams* fp) {
+    AySynthState* st = &synth->state;
+    const uint64_t frame_units = (uint64_t)fp->samples * synth->ay_clock;
+
+    for (int c = 0; c < 3; c++) {
+        uint64_t total = st->tone_counter[c] + frame_units;
+        uint64_t toggles = total / fp->tone_period[c];
+        st->tone_bit[c] ^= (uint8_t)(toggles & 1);
+        st->tone_counter[c] = total % fp->tone_period[c];
+    }
+}
+
+// Integral of a square wave at every sample edge. y is the time in ticks
+// since the start of the current half period, the wave starts at level
+// 'bit' and flips every 'period' ticks.
+static void square_integral(float* h, int count, float y0, float dt, float period, int bit) {
+    const vfloat p = vset1(period);
+    const vfloat inv_p2 = vset1(0.5f / period);
+    const vfloat p2 = vset1(2.0f * period);
+    const vfloat zero = vset1(0.0f);
+    const vfloat step = vset1(dt * VLANES);
+    vfloat y = vadd(vset1(y0), vmul(vramp(), vset1(dt)));
+
+    for (int j = 0; j < count; j += VLANES) {
+        vfloat q = vfloor(vmul(y, inv_p2));
+        vfloat r = vsub(y, vmul(q, p2));
+        vfloat part = bit ? vmin(r, p) : vmax(vsub(r, p), zero);
+        vstore(h + j, vadd(vmul(q, p), part));
+        y = vadd(y, step);
+    }
+}
+
+static void mix_channel(AySynth* synth, int c, const uint8_t* regs, int count, float inv_dt) {
+    const int tone_on = !(regs[7] & (1 << c));
+    const int noise_on = !(regs[7] & (8 << c));
+    const int env_on = (regs[8 + c] & 0x10) != 0;
+
+    const vfloat one = vset1(1.0f);
+    const vfloat vinv_dt = vset1(inv_dt);
+    const vfloat fixed_amp = vset1(dac_table[regs[8 + c] & 0x0F]);
+    const vfloat wl = vset1(synth->pan_left[c]);
+    const vfloat wr = vset1(synth->pan_right[c]);
+    const float* h = synth->edges;
+
+    for (int j = 0; j < count; j += VLANES) {
+        vfloat out = tone_on ? vmul(vsub(vload(h + j + 1), vload(h + j)), vinv_dt) : one;
+        if (noise_on) out = vmul(out, vload(synth->noise + j));
+        out = vmul(out, env_on ? vload(synth->env_amp + j) : fixed_amp);
+
+        vstore(synth->left + j, vadd(vload(synth->left + j), vmul(out, wl)));
+        if (synth->channels == 2) {
+            vstore(synth->right + j, vadd(vload(synth->right + j), vmul(out, wr)));
+        }
+    }
+}
+
+//
+// Band-limited mode
+//
+
+#define BLEP_ZERO_CROSSINGS 16
+#define BLEP_OVERSAMPLE 64
+#define BLEP_FFT_SIZE 8192
+
+// residual[phase][k] is the minBLEP step minus the ideal step, k samples
+// after the first sample at or past the edge, where that sample lies
+// phase / BLEP_OVERSAMPLE samples after the edge.
+typedef struct BlepTable {
+    float residual[BLEP_OVERSAMPLE + 1][AYSYNTH_BLEP_TAPS];
+} BlepTable;
+
+typedef std::complex<double> cplx;
+
+static void fft(std::vector<cplx>& a, int inverse) {
+    const size_t n = a.size();
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(a[i], a[j]);
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double angle = 2 * 3.14159265358979323846 / (double)len * (inverse ? 1 : -1);
+        cplx wlen(cos(angle), sin(angle));
+        for (size_t i = 0; i < n; i += len) {
+            cplx w(1);
+            for (size_t k = 0; k < len / 2; k++) {
+                cplx u = a[i + k], v = a[i + k + len / 2] * w;
+                a[i + k] = u + v;
+                a[i + k + len / 2] = u - v;
+                w *= wlen;
+            }
+        }
+    }
+    if (inverse) {
+        for (size_t i = 0; i < n; i++) a[i] /= (double)n;
+    }
+}
+
+// Minimum phase version of a Blackman windowed sinc via the real cepstrum
+// (Brandt, "Hard Sync Without Aliasing"), integrated into a step.
+static BlepTable* build_blep_table() {
+    const int taps = BLEP_ZERO_CROSSINGS * 2 * BLEP_OVERSAMPLE + 1;
+    const double pi = 3.14159265358979323846;
+    std::vector<cplx> a(BLEP_FFT_SIZE);
+
+    for (int i = 0; i < taps; i++) {
+        double x = (double)(i - taps / 2) / BLEP_OVERSAMPLE;
+        double sinc = x == 0 ? 1.0 : sin(pi * x) / (pi * x);
+        double w = (double)i / (taps - 1);
+        double window = 0.42 - 0.5 * cos(2 * pi * w) + 0.08 * cos(4 * pi * w);
+        a[i] = sinc * window;
+    }
+
+    fft(a, 0);
+    for (int i = 0; i < BLEP_FFT_SIZE; i++) a[i] = log(std::max(abs(a[i]), 1e-12));
+    fft(a, 1);
+    for (int i = 1; i < BLEP_FFT_SIZE / 2; i++) a[i] *= 2.0;
+    for (int i = BLEP_FFT_SIZE / 2 + 1; i < BLEP_FFT_SIZE; i++) a[i] = 0;
+    a[0] = a[0].real();
+    a[BLEP_FFT_SIZE / 2] = a[BLEP_FFT_SIZE / 2].real();
+    fft(a, 0);
+    for (int i = 0; i < BLEP_FFT_SIZE; i++) a[i] = exp(a[i]);
+    fft(a, 1);
+
+    const int length = AYSYNTH_BLEP_TAPS * BLEP_OVERSAMPLE + BLEP_OVERSAMPLE;
+    std::vector<double> step(length);
+    double sum = 0;
+    for (int i = 0; i < length; i++) {
+        if (i < taps) sum += a[i].real();
+        step[i] = sum;
+    }
+
+    BlepTable* table = (BlepTable*)malloc(sizeof(BlepTable));
+    if (!table) return NULL;
+    for (int phase = 0; phase <= BLEP_OVERSAMPLE; phase++) {
+        for (int k = 0; k < AYSYNTH_BLEP_TAPS; k++) {
+            // Fade the last taps so the residual ends at exactly zero
+            double fade = k < AYSYNTH_BLEP_TAPS - 4 ? 1.0 : (AYSYNTH_BLEP_TAPS - k) / 5.0;
+            table->residual[phase][k] = (float)((step[k * BLEP_OVERSAMPLE + phase] / sum - 1.0) * fade);
+        }
+    }
+    return table;
+}
+
+static const BlepTable* blep_table() {
+    static const BlepTable* table = build_blep_table();
+    return table;
+}
+
+static inline float channel_level(const AySynthState* st, const uint8_t* regs, int c, int tone_dc) {
+    float tone = (regs[7] & (1 << c)) ? 1.0f : tone_dc ? 0.5f : (float)st->tone_bit[c];
+    float noise = (regs[7] & (8 << c)) ? 1.0f : (float)(st->noise_lfsr & 1);
+    float amp = (regs[8 + c] & 0x10) ? dac_table[st->env_level] : dac_table[regs[8 + c] & 0x0F];
+    return tone * noise * amp;
+}
+
+static void add_blep(AySynth* synth, const float* residual, int index, float left, float right) {
+    const vfloat wl = vset1(left);
+    const vfloat wr = vset1(right);
+    float* l = synth->left + index;
+    float* r = synth->right + index;
+    for (int k = 0; k < AYSYNTH_BLEP_TAPS; k += VLANES) {
+        vfloat res = vload(residual + k);
+        vstore(l + k, vadd(vload(l + k), vmul(res, wl)));
+        vstore(r + k, vadd(vload(r + k), vmul(res, wr)));
+    }
+}
+
+// Walks the frame edge by edge in exact time units. Between edges the output
+// is the ideal level; every edge adds a band-limited correction.
+static void render_frame_blep(AySynth* synth, const uint8_t* regs, const FrameParams* fp) {
+    AySynthState* st = &synth->state;
+    const BlepTable* table = blep_table();
+    const int count = fp->samples;
+    const uint64_t sample_units = synth->ay_clock;
+    const uint64_t frame_units = (uint64_t)count * sample_units;
+
+    // Residuals spilling over from the last frame
+    memmove(synth->left, synth->left + count, AYSYNTH_BLEP_TAPS * sizeof(float));
+    memmove(synth->right, synth->right + count, AYSYNTH_BLEP_TAPS * sizeof(float));
+    memset(synth->left + AYSYNTH_BLEP_TAPS, 0, PADDED(count + 1) * sizeof(float));
+    memset(synth->right + AYSYNTH_BLEP_TAPS, 0, PADDED(count + 1) * sizeof(float));
+
+    // Tones above Nyquist are replaced by their average, the rest toggle
+    // on schedule (the state itself is moved on by advance_tones)
+    const uint64_t never = ~0ULL;
+    int tone_dc[3];
+    uint64_t tone_due[3];
+    uint8_t tone_bit[3];
+    for (int c = 0; c < 3; c++) {
+        tone_dc[c] = fp->tone_period[c] < sample_units;
+        tone_due[c] = (tone_dc[c] || (regs[7] & (1 << c))) ? never : fp->tone_period[c] - st->tone_counter[c];
+        tone_bit[c] = st->tone_bit[c];
+    }
+    uint64_t noise_due = fp->noise_period - st->noise_counter;
+    uint64_t env_due = fp->env_period - st->env_counter;
+
+    float level[3];
+    float out_left = 0, out_right = 0;
+    for (int c = 0; c < 3; c++) {
+        level[c] = st->channel_level[c];
+        out_left += level[c] * synth->pan_left[c];
+        out_right += level[c] * synth->pan_right[c];
+    }
+
+    int filled = 0;
+    uint64_t t = 0;
+    for (;;) {
+        // Edge at t: first affected sample and its distance past the edge
+        int index = (int)((t + sample_units - 1) / sample_units);
+        uint64_t past = (uint64_t)index * sample_units - t;
+        int phase = (int)(past * BLEP_OVERSAMPLE / sample_units);
+
+        for (; filled < index && filled < count; filled++) {
+            synth->left[filled] += out_left;
+            synth->right[filled] += out_right;
+        }
+
+        int changed = 0;
+        float new_level[3];
+        for (int c = 0; c < 3; c++) {
+            new_level[c] = channel_level(st, regs, c, tone_dc[c]);
+            if (new_level[c] != level[c]) {
+                float delta = new_level[c] - level[c];
+                add_blep(synth, table->residual[phase], index,
+                    delta * synth->pan_left[c], delta * synth->pan_right[c]);
+                changed = 1;
+            }
+        }
+        if (changed) {
+            out_left = out_right = 0;
+            for (int c = 0; c < 3; c++) {
+                level[c] = new_level[c];
+                out_left += level[c] * synth->pan_left[c];
+                out_right += level[c] * synth->pan_right[c];
+            }
+        }
+
+        uint64_t next = noise_due < env_due ? noise_due : env_due;
+        for (int c = 0; c < 3; c++) {
+            if (tone_due[c] < next) next = tone_due[c];
+        }
+        // Edges exactly on the frame end belong to this frame, as they do
+        // when the state is only advanced
+        if (next > frame_units) break;
+        t = next;
+
+        for (int c = 0; c < 3; c++) {
+            if (tone_due[c] == t) {
+                st->tone_bit[c] ^= 1;
+                tone_due[c] += fp->tone_period[c];
+            }
+        }
+        if (noise_due == t) {
+            noise_step(st);
+            noise_due += fp->noise_period;
+        }
+        if (env_due == t) {
+            env_step(st);
+            env_due += fp->env_period;
+        }
+    }
+
+    for (; filled < count; filled++) {
+        synth->left[filled] += out_left;
+        synth->right[filled] += out_right;
+    }
+
+    for (int c = 0; c < 3; c++) {
+        st->tone_bit[c] = tone_bit[c];
+        st->channel_level[c] = level[c];
+    }
+    st->noise_counter = fp->noise_period - (noise_due - frame_units);
+    st->env_counter = fp->env_period - (env_due - frame_units);
+    advance_tones(synth, fp);
+}
+
+static inline int16_t to_sample(float x) {
+    long v = lrintf(x);
+    if (v > 32767) v = 32767;
+    if (v < -32768) v = -32768;
+    return (int16_t)v;
+}
+
+static void store_samples(const AySynth* synth, int count, int16_t* out) {
+    int j = 0;
+
+    if (synth->channels == 1) {
+#if defined(AYSYNTH_SSE2) || defined(AYSYNTH_AVX2)
+        for (; j + 8 <= count; j += 8) {
+            __m128i a = _mm_cvtps_epi32(_mm_loadu_ps(synth->left + j));
+            __m128i b = _mm_cvtps_epi32(_mm_loadu_ps(synth->left + j + 4));
+            _mm_storeu_si128((__m128i*)(out + j), _mm_packs_epi32(a, b));
+        }
+#endif
+        for (; j < count; j++) out[j] = to_sample(synth->left[j]);
+        return;
+    }
+
+#if defined(AYSYNTH_SSE2) || defined(AYSYNTH_AVX2)
+    for (; j + 4 <= count; j += 4) {
+        __m128i l = _mm_cvtps_epi32(_mm_loadu_ps(synth->left + j));
+        __m128i r = _mm_cvtps_epi32(_mm_loadu_ps(synth->right + j));
+        __m128i l16 = _mm_packs_epi32(l, l);
+        __m128i r16 = _mm_packs_epi32(r, r);
+        _mm_storeu_si128((__m128i*)(out + j * 2), _mm_unpacklo_epi16(l16, r16));
+    }
+#endif
+    for (; j < count; j++) {
+        out[j * 2] = to_sample(synth->left[j]);
+        out[j * 2 + 1] = to_sample(synth->right[j]);
+    }
+}
+
+int aysynth_init(AySynth* synth, uint32_t ay_clock, uint32_t cpu_clock, uint32_t frame_tstates,
+    const PcmSettings* settings)
+{
+    memset(synth, 0, sizeof(*synth));
+
+    if (cpu_clock == 0 || frame_tstates == 0 || settings->sample_rate == 0) {
+        return -1;
+    }
+
+    synth->ay_clock = ay_clock;
+    synth->sample_rate = settings->sample_rate;
+    synth->cpu_clock = cpu_clock;
+    synth->frame_length = (uint64_t)settings->sample_rate * frame_tstates;
+    synth->samples_per_frame = (uint32_t)((synth->frame_length + cpu_clock - 1) / cpu_clock);
+    synth->tick_units = 8ULL * settings->sample_rate;
+    synth->channels = settings->layout == STEREO_MONO ? 1 : 2;
+    synth->band_limited = settings->band_limited;
+    if (synth->band_limited && !blep_table()) {
+        return -1;
+    }
+
+    // Equal power panning: A left, C right, B centre (ABC) or swapped (ACB)
+    static const float pan_abc[3] = { 0.1f, 0.5f, 0.9f };
+    static const float pan_acb[3] = { 0.1f, 0.9f, 0.5f };
+    const float* pan = settings->layout == STEREO_ACB ? pan_acb : pan_abc;
+    float sum_left = 0, sum_right = 0;
+    for (int c = 0; c < 3; c++) {
+        if (synth->channels == 1) {
+            synth->pan_left[c] = synth->pan_right[c] = 1.0f;
+        }
+        else {
+            synth->pan_left[c] = sqrtf(1.0f - pan[c]);
+            synth->pan_right[c] = sqrtf(pan[c]);
+        }
+        sum_left += synth->pan_left[c];
+        sum_right += synth->pan_right[c];
+    }
+    for (int c = 0; c < 3; c++) {
+        synth->pan_left[c] *= 32767.0f / sum_left;
+        synth->pan_right[c] *= 32767.0f / sum_right;
+    }
+
+    size_t padded = PADDED(synth->samples_per_frame + 1 + AYSYNTH_BLEP_TAPS);
+    synth->edges = (float*)calloc(padded, sizeof(float));
+    synth->noise = (float*)calloc(padded, sizeof(float));
+    synth->env_amp = (float*)calloc(padded, sizeof(float));
+    synth->left = (float*)calloc(padded, sizeof(float));
+    synth->right = (float*)calloc(padded, sizeof(float));
+    if (!synth->edges || !synth->noise || !synth->env_amp || !synth->left || !synth->right) {
+        aysynth_free(synth);
+        return -1;
+    }
+
+    synth->state.noise_lfsr = 1;
+    env_reset_segment(&synth->state);
+    return 0;
+}
+
+void aysynth_free(AySynth* synth) {
+    free(synth->edges);
+    free(synth->noise);
+    free(synth->env_amp);
+    free(synth->left);
+    free(synth->right);
+    synth->edges = synth->noise = synth->env_amp = synth->left = synth->right = NULL;
+}
+
+int aysynth_render_frame(AySynth* synth, const uint8_t regs[16], int env_written, int16_t* out) {
+    AySynthState* st = &synth->state;
+    FrameParams fp;
+    apply_registers(synth, regs, env_written, &fp);
+
+    if (synth->band_limited) {
+        render_frame_blep(synth, regs, &fp);
+        store_samples(synth, fp.samples, out);
+        return fp.samples;
+    }
+
+    const int count = fp.samples;
+    const uint64_t sample_units = synth->ay_clock;
+
+    // Noise and envelope are point sampled at the start of each sample. They
+    // are sequential, so this pass is scalar.
+    for (int j = 0; j < count; j++) {
+        synth->noise[j] = (float)(st->noise_lfsr & 1);
+        synth->env_amp[j] = dac_table[st->env_level];
+
+        st->noise_counter += sample_units;
+        while (st->noise_counter >= fp.noise_period) {
+            st->noise_counter -= fp.noise_period;
+            noise_step(st);
+        }
+        st->env_counter += sample_units;
+        while (st->env_counter >= fp.env_period) {
+            st->env_counter -= fp.env_period;
+            env_step(st);
+        }
+    }
+
+    // Tone channels are box filtered over each sample
+    const float tick = (float)synth->tick_units;
+    const float dt = (float)sample_units / tick;
+    const float inv_dt = 1.0f / dt;
+
+    memset(synth->left, 0, PADDED(count + 1) * sizeof(float));
+    memset(synth->right, 0, PADDED(count + 1) * sizeof(float));
+
+    for (int c = 0; c < 3; c++) {
+        square_integral(synth->edges, count + 1,
+            (float)st->tone_counter[c] / tick, dt,
+            (float)fp.tone_period[c] / tick, st->tone_bit[c]);
+        mix_channel(synth, c, regs, count, inv_dt);
+    }
+
+    advance_tones(synth, &fp);
+    store_samples(synth, count, out);
+    return count;
+}
+
+void aysynth_advance_frame(AySynth* synth, const uint8_t regs[16], int env_written) {
+    AySynthState* st = &synth->state;
+    FrameParams fp;
+    apply_registers(synth, regs, env_written, &fp);
+
+    const uint64_t frame_units = (uint64_t)fp.samples * synth->ay_clock;
+    st->noise_counter += frame_units;
+    while (st->noise_counter >= fp.noise_period) {
+        st->noise_counter -= fp.noise_period;
+        noise_step(st);
+    }
+    st->env_counter += frame_units;
+    while (st->env_counter >= fp.env_period) {
+        st->env_counter -= fp.env_period;
+        env_step(st);
+    }
+    advance_tones(synth, &fp);
+
+    if (synth->band_limited) {
+        for (int c = 0; c < 3; c++) {
+            st->channel_level[c] = channel_level(st, regs, c, fp.tone_period[c] < synth->ay_clock);
+        }
+    }
+}
+
+void aysynth_restore(AySynth* synth, const AySynthState* state) {
+    size_t padded = PADDED(synth->samples_per_frame + 1 + AYSYNTH_BLEP_TAPS);
+    synth->state = *state;
+    memset(synth->left, 0, padded * sizeof(float));
+    memset(synth->right, 0, padded * sizeof(float));
+}
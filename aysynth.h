@@ -0,0 +1,97 @@
+/* aysynth.h
+ * AY-3-8910 / YM2149 PCM renderer driven by the per-frame register stream.
+ *
+ * Tone counters, noise LFSR and envelope generator advance in exact integer
+ * time units (one sample is ay_clock units, one chip tick at clock/8 is
+ * 8 * sample_rate units), so the synth state at a frame boundary doesn't
+ * depend on how the samples in between were produced. The per-sample tone
+ * generation and mixing runs on SSE2 or AVX2 when available.
+ *
+ * That also lets a cheap pass that only advances the state record
+ * checkpoints from which stretches of a song can be rendered independently.
+ *
+ * In band-limited mode every change of a channel's output level (tone,
+ * noise or envelope edge) is placed at its exact time with a minBLEP step
+ * instead, which removes aliasing without running the chip at its clock.
+ */
+
+#ifndef __AYSYNTH_INCLUDED__
+#define __AYSYNTH_INCLUDED__
+
+#include <stdint.h>
+
+typedef enum {
+    STEREO_ABC = 0,
+    STEREO_ACB,
+    STEREO_MONO
+} StereoLayout;
+
+typedef struct PcmSettings {
+    uint32_t sample_rate;
+    StereoLayout layout;
+    int band_limited;         // minBLEP synthesis instead of box filtering
+} PcmSettings;
+
+// Samples a band-limited step takes to settle
+#define AYSYNTH_BLEP_TAPS 32
+
+// Everything that carries over from one frame to the next
+typedef struct AySynthState {
+    uint64_t tone_counter[3];     // time into the current half period
+    uint8_t tone_bit[3];
+    uint64_t noise_counter;
+    uint32_t noise_lfsr;          // 17-bit shift register
+    uint64_t env_counter;
+    int env_level;                // 0..15
+    int env_segment;              // 0 or 1, see envelope shape table
+    uint8_t env_shape;
+    uint32_t frame_phase;         // exact start of the next frame past its first sample, 1/cpu_clock samples
+    float channel_level[3];       // band-limited mode: output level at the end of the last frame
+} AySynthState;
+
+typedef struct AySynth {
+    AySynthState state;
+
+    uint32_t ay_clock;
+    uint32_t sample_rate;
+    uint32_t cpu_clock;
+    uint64_t frame_length;        // sample_rate * frame_tstates: one frame in samples, times cpu_clock
+    uint32_t samples_per_frame;   // most samples a frame renders
+    uint64_t tick_units;          // time units per chip tick (8 * sample_rate)
+    int channels;                 // 1 or 2
+    int band_limited;
+    float pan_left[3];
+    float pan_right[3];
+
+    // Per-frame scratch buffers, samples_per_frame (+ padding) long. In
+    // band-limited mode left/right also carry the step residuals that spill
+    // into the next frame.
+    float* edges;                 // square wave integral at sample edges
+    float* noise;
+    float* env_amp;
+    float* left;
+    float* right;
+} AySynth;
+
+// Frames are frame_tstates CPU cycles at cpu_clock long, which needn't be a
+// whole number of samples. Returns 0 on success, -1 on bad settings or
+// allocation failure.
+int aysynth_init(AySynth* synth, uint32_t ay_clock, uint32_t cpu_clock, uint32_t frame_tstates,
+    const PcmSettings* settings);
+void aysynth_free(AySynth* synth);
+
+// Render one frame as interleaved samples, returns the samples per channel.
+// That is samples_per_frame or one less when the frame period isn't a whole
+// number of samples; rounding doesn't add up over a song.
+int aysynth_render_frame(AySynth* synth, const uint8_t regs[16], int env_written, int16_t* out);
+
+// Advance the state by one frame without producing samples. The state ends
+// up exactly where aysynth_render_frame would leave it.
+void aysynth_advance_frame(AySynth* synth, const uint8_t regs[16], int env_written);
+
+// Continue from a recorded state. In band-limited mode the steps still
+// settling from the frame before are lost, so render one frame before the
+// first one that is kept to get sample-exact output.
+void aysynth_restore(AySynth* synth, const AySynthState* state);
+
+#endif
@@ -0,0 +1,201 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "batch.h"
+#include "ay2ym.h"
+#include "hash.h"
+#include "workqueue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void batch_plan(const std::vector<FileIndexEntry>& files, std::vector<BatchJob>* jobs) {
+    for (size_t i = 0; i < files.size(); i++) {
+        const FileIndexEntry& file = files[i];
+        if (file.status == INDEX_READ_ERROR) continue;
+
+        for (size_t k = 0; k < file.songs.size(); k++) {
+            const SongIndexEntry& song = file.songs[k];
+            BatchJob job;
+            job.path = file.path;
+            job.song = song.index;
+
+            // Songs that won't be emulated still cost a little to parse
+            int emulated = song.has_points && song.machine != MACHINE_UNKNOWN;
+            job.cost = emulated ? (uint32_t)song.song_length + song.fade_length : 1;
+            jobs->push_back(job);
+        }
+    }
+}
+
+static int is_separator(char c) {
+    return c == '/' || c == '\\';
+}
+
+// Path of a collected file relative to the root it was found under, or its
+// name if it was given as a root itself
+static std::string relative_path(const std::string& path, const char* const* roots, int root_count) {
+    size_t skip = 0;
+    for (int i = 0; i < root_count; i++) {
+        size_t length = strlen(roots[i]);
+        if (length > skip && length < path.size() && path.compare(0, length, roots[i]) == 0 &&
+            (is_separator(path[length]) || is_separator(path[length - 1]))) {
+            skip = length;
+        }
+    }
+    if (skip == 0) {
+        for (size_t i = 0; i < path.size(); i++) {
+            if (is_separator(path[i])) skip = i + 1;
+        }
+    }
+    while (skip < path.size() && is_separator(path[skip])) skip++;
+    return path.substr(skip);
+}
+
+void batch_shard(std::vector<std::string>* paths, const char* const* roots, int root_count,
+    uint32_t index, uint32_t count)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < paths->size(); i++) {
+        // Separators are hashed as '/' so Windows and POSIX nodes agree
+        std::string relative = relative_path((*paths)[i], roots, root_count);
+        std::replace(relative.begin(), relative.end(), '\\', '/');
+        uint64_t h = hash64(HASH64_SEED, relative.data(), relative.size());
+        if (h % count == index) (*paths)[kept++] = (*paths)[i];
+    }
+    paths->resize(kept);
+}
+
+void batch_order_longest_first(std::vector<BatchJob>* jobs) {
+    std::stable_sort(jobs->begin(), jobs->end(), [](const BatchJob& a, const BatchJob& b) {
+        return a.cost > b.cost;
+    });
+}
+
+// A source file, loaded once for all of its jobs. It's released when the
+// last of them has been converted.
+typedef struct BatchFile {
+    std::once_flag loaded;
+    std::atomic<size_t> jobs_left;
+    const uint8_t* data;
+    size_t size;
+} BatchFile;
+
+// A job with its file loaded
+typedef struct LoadedJob {
+    const BatchJob* job;
+    BatchFile* file;
+} LoadedJob;
+
+// Maps the file read-only (reads it into memory on Windows). data stays
+// NULL if it can't be read or is empty.
+static void load_file(const char* path, BatchFile* file) {
+    file->data = NULL;
+    file->size = 0;
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // Every song parses the whole file: fault it in ahead of the workers
+            madvise(data, (size_t)st.st_size, MADV_WILLNEED);
+            file->data = (const uint8_t*)data;
+            file->size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+#else
+    FILE* f = fopen(path, "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* data = length > 0 ? (uint8_t*)malloc((size_t)length) : NULL;
+    if (data && fread(data, 1, (size_t)length, f) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    file->data = data;
+    file->size = data ? (size_t)length : 0;
+#endif
+}
+
+static void unload_file(BatchFile* file) {
+    if (!file->data) return;
+#if !defined(_WIN32)
+    munmap((void*)file->data, file->size);
+#else
+    free((void*)file->data);
+#endif
+    file->data = NULL;
+}
+
+void batch_run(const std::vector<BatchJob>& jobs, unsigned int workers, BatchConvertFunc convert) {
+    if (workers == 0) workers = std::thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+    if (workers > jobs.size()) workers = (unsigned int)jobs.size();
+    unsigned int readers = BATCH_READERS;
+    if (readers > jobs.size()) readers = (unsigned int)jobs.size();
+
+    // The songs of a file share one load
+    std::map<std::string, size_t> file_numbers;
+    std::vector<size_t> job_files(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        job_files[i] = file_numbers.insert(std::make_pair(jobs[i].path, file_numbers.size())).first->second;
+    }
+    std::vector<BatchFile> files(file_numbers.size());
+    for (size_t i = 0; i < files.size(); i++) files[i].jobs_left = 0;
+    for (size_t i = 0; i < jobs.size(); i++) files[job_files[i]].jobs_left++;
+
+    WorkQueue loaded;
+    if (workqueue_init(&loaded, BATCH_READ_QUEUE) != 0) return;
+
+    // Readers take jobs in order, so files arrive roughly in schedule order.
+    // The first job of a file loads it; a reader on a later job of the same
+    // file waits for that load instead of reading it again.
+    std::atomic<size_t> next(0);
+    auto reader = [&]() {
+        for (size_t i = next.fetch_add(1); i < jobs.size(); i = next.fetch_add(1)) {
+            BatchFile* file = &files[job_files[i]];
+            std::call_once(file->loaded, load_file, jobs[i].path.c_str(), file);
+            LoadedJob* item = new LoadedJob;
+            item->job = &jobs[i];
+            item->file = file;
+            workqueue_push(&loaded, item);
+        }
+    };
+
+    auto worker = [&]() {
+        void* next_item;
+        while (workqueue_pop(&loaded, &next_item)) {
+            LoadedJob* item = (LoadedJob*)next_item;
+            convert(item->job, item->file->data, item->file->size);
+            if (--item->file->jobs_left == 0) unload_file(item->file);
+            delete item;
+        }
+    };
+
+    std::vector<std::thread> reader_threads;
+    for (unsigned int i = 0; i < readers; i++) reader_threads.emplace_back(reader);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < workers; i++) threads.emplace_back(worker);
+
+    for (size_t i = 0; i < reader_threads.size(); i++) reader_threads[i].join();
+    workqueue_close(&loaded);
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+    workqueue_free(&loaded);
+}
@@ -0,0 +1,63 @@
+/* batch.h
+ * Batch conversion of many files and songs on a worker pool.
+ *
+ * Every (file, song) pair is a job. Its cost is the song's length plus fade
+ * in frames, taken from the header-only index (with the address table
+ * estimate or the default where the header has no length). Jobs are started
+ * longest first, each going to the next free worker, so a single long song
+ * is picked up at the start on a worker of its own instead of ending up as
+ * the tail of the run.
+ *
+ * A run can be split over machines with --shard i/N. Each file goes to the
+ * shard picked by a hash of its path relative to the root it was found
+ * under, so every node computes the same split on its own, wherever the
+ * collection is mounted and in whatever order the directories list. Files
+ * are split before the index is built: a node only reads its own files.
+ *
+ * The run is a pipeline so the converting threads don't stall on slow
+ * storage: reader threads map the files of upcoming jobs, converting
+ * workers take them from a bounded queue, and outputs are written by the
+ * sink threads (or the pack writer). A file is mapped once for all of its
+ * songs and unmapped after the last one. A full queue holds the readers
+ * back, so memory use stays bounded however fast they are (apart from
+ * files whose songs are far apart in the order, which stay mapped in
+ * between).
+ */
+
+#ifndef __BATCH_INCLUDED__
+#define __BATCH_INCLUDED__
+
+#include "ayindex.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define BATCH_READERS 4           // files being read at the same time
+#define BATCH_READ_QUEUE 64       // files read ahead of the workers (power of two)
+
+typedef struct BatchJob {
+    std::string path;         // source AY file
+    int song;                 // song index within the file
+    uint32_t cost;            // estimated frames to emulate
+} BatchJob;
+
+// Convert one song from the file's bytes, or report that it couldn't be
+// read if data is NULL
+typedef void (*BatchConvertFunc)(const BatchJob* job, const uint8_t* data, size_t size);
+
+// One job per song of every readable file
+void batch_plan(const std::vector<FileIndexEntry>& files, std::vector<BatchJob>* jobs);
+
+// Keep only the collected files of shard `index` out of `count`. roots are
+// the files and directories the paths were collected from.
+void batch_shard(std::vector<std::string>* paths, const char* const* roots, int root_count,
+    uint32_t index, uint32_t count);
+
+// Longest processing time first; ties keep path and song order
+void batch_order_longest_first(std::vector<BatchJob>* jobs);
+
+// Run the jobs in the given order on `workers` converting threads (0: one
+// per core), fed by BATCH_READERS reader threads
+void batch_run(const std::vector<BatchJob>& jobs, unsigned int workers, BatchConvertFunc convert);
+
+#endif
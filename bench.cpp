@@ -0,0 +1,60 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "bench.h"
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+uint64_t bench_peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return (uint64_t)counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;           // bytes
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;    // kilobytes
+#endif
+#endif
+}
+
+static double per_second(double count, double seconds) {
+    return seconds > 0 ? count / seconds : 0;
+}
+
+void bench_print(FILE* out, const BenchSummary* s) {
+    fprintf(out, "%u files, %u songs, %llu frames, %llu cycles, %llu bytes written in %.3f s\n",
+        s->files, s->songs, (unsigned long long)s->frames, (unsigned long long)s->cycles,
+        (unsigned long long)s->bytes_written, s->seconds);
+    fprintf(out, "%.2f songs/s, %.0f frames/s, %.1f MHz, %.0fx realtime, peak RSS %.1f MB\n",
+        per_second(s->songs, s->seconds), per_second((double)s->frames, s->seconds),
+        per_second((double)s->cycles, s->seconds) / 1e6,
+        per_second(s->play_seconds, s->seconds), s->peak_rss / (1024.0 * 1024.0));
+}
+
+int bench_write_json(const char* path, const BenchSummary* s) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        printf("Can't open benchmark file '%s'\n", path);
+        return -1;
+    }
+
+    fprintf(out, "{\"files\":%u,\"songs\":%u,\"frames\":%llu,\"cycles\":%llu,\"bytes_written\":%llu,"
+        "\"seconds\":%.6f,\"songs_per_second\":%.3f,\"frames_per_second\":%.1f,\"mhz\":%.3f,"
+        "\"realtime_factor\":%.3f,\"peak_rss\":%llu}\n",
+        s->files, s->songs, (unsigned long long)s->frames, (unsigned long long)s->cycles,
+        (unsigned long long)s->bytes_written, s->seconds, per_second(s->songs, s->seconds),
+        per_second((double)s->frames, s->seconds), per_second((double)s->cycles, s->seconds) / 1e6,
+        per_second(s->play_seconds, s->seconds), (unsigned long long)s->peak_rss);
+
+    int failed = ferror(out) != 0;
+    if (fclose(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
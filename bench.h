@@ -0,0 +1,37 @@
+/* bench.h
+ * End-to-end conversion benchmark report (--bench).
+ *
+ * ay2ym converts every input on one thread, exactly as a single-file run
+ * does (outputs included), and sums the per-song counters; this module adds
+ * the process's peak memory and turns the totals into songs/s, frames/s
+ * and realtime factor, as text or JSON. Run it over the synthetic corpus
+ * (--make-corpus) to get numbers that can be compared between builds and
+ * machines.
+ */
+
+#ifndef __BENCH_INCLUDED__
+#define __BENCH_INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct BenchSummary {
+    uint32_t files;
+    uint32_t songs;
+    uint64_t frames;
+    double play_seconds;      // how long the frames play
+    uint64_t cycles;          // CPU cycles emulated
+    uint64_t bytes_written;
+    double seconds;           // wall time of the conversions
+    uint64_t peak_rss;        // bytes, 0 if unknown
+} BenchSummary;
+
+// Peak resident set size of this process in bytes, 0 if unknown
+uint64_t bench_peak_rss();
+
+void bench_print(FILE* out, const BenchSummary* summary);
+
+// Returns 0 on success, -1 on failure
+int bench_write_json(const char* path, const BenchSummary* summary);
+
+#endif
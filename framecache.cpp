@@ -0,0 +1,173 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "framecache.h"
+#include "hash.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <thread>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define make_dir(path) _mkdir(path)
+#define process_id() _getpid()
+#else
+#include <unistd.h>
+#define make_dir(path) mkdir((path), 0777)
+#define process_id() getpid()
+#endif
+
+static_assert(sizeof(FrameRecord) == 17, "FrameRecord is stored as raw bytes");
+
+#define CACHE_HEADER_SIZE 24
+
+int framelog_reserve(FrameLog* log, uint32_t count) {
+    if (count <= log->capacity) return 0;
+    FrameRecord* frames = (FrameRecord*)realloc(log->frames, count * sizeof(FrameRecord));
+    if (!frames) return -1;
+    log->frames = frames;
+    log->capacity = count;
+    return 0;
+}
+
+int framelog_append(FrameLog* log, const uint8_t regs[16], int env_written) {
+    if (log->count == log->capacity) {
+        uint32_t capacity = log->capacity ? log->capacity * 2 : 4096;
+        FrameRecord* frames = (FrameRecord*)realloc(log->frames, capacity * sizeof(FrameRecord));
+        if (!frames) return -1;
+        log->frames = frames;
+        log->capacity = capacity;
+    }
+    FrameRecord* record = &log->frames[log->count++];
+    memcpy(record->regs, regs, 16);
+    record->env_written = (uint8_t)(env_written != 0);
+    return 0;
+}
+
+void framelog_free(FrameLog* log) {
+    free(log->frames);
+    log->frames = NULL;
+    log->count = log->capacity = 0;
+}
+
+uint64_t framecache_key(uint64_t file_hash, int song_index, const char* options) {
+    uint64_t key = hash64_u32(HASH64_SEED, FRAME_CACHE_VERSION);
+    key = hash64_u64(key, file_hash);
+    key = hash64_u32(key, (uint32_t)song_index);
+    return hash64(key, options, strlen(options));
+}
+
+static void entry_path(char* path, size_t size, const char* dir, uint64_t key, const char* ext) {
+    snprintf(path, size, "%s/%016llx.%s", dir, (unsigned long long)key, ext);
+}
+
+int cache_write_entry(const char* dir, uint64_t key, const char* ext, const uint8_t* data, size_t size) {
+    if (make_dir(dir) != 0 && errno != EEXIST) {
+        printf("Can't create cache directory '%s'\n", dir);
+        return -1;
+    }
+
+    char path[1024], temp[1100];
+    entry_path(path, sizeof(path), dir, key, ext);
+    snprintf(temp, sizeof(temp), "%s.%d.%zx.tmp", path, (int)process_id(),
+        std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    uint8_t checksum[8];
+    cache_put_u64(checksum, hash64(HASH64_SEED, data, size));
+
+    FILE* file = fopen(temp, "wb");
+    if (!file) return -1;
+    int failed = fwrite(data, 1, size, file) != size ||
+        fwrite(checksum, 1, sizeof(checksum), file) != sizeof(checksum);
+    if (fclose(file) != 0) failed = 1;
+
+    if (!failed && rename(temp, path) != 0) {
+        // Windows won't rename over an existing entry
+        remove(path);
+        failed = rename(temp, path) != 0;
+    }
+    if (failed) {
+        remove(temp);
+        return -1;
+    }
+    return 0;
+}
+
+int cache_read_entry(const char* dir, uint64_t key, const char* ext, uint8_t** data, size_t* size) {
+    char path[1024];
+    entry_path(path, sizeof(path), dir, key, ext);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* buffer = length >= 8 ? (uint8_t*)malloc(length) : NULL;
+    int failed = !buffer || fread(buffer, 1, length, file) != (size_t)length;
+    fclose(file);
+
+    if (!failed) {
+        *size = (size_t)length - 8;
+        failed = hash64(HASH64_SEED, buffer, *size) != cache_get_u64(buffer + *size);
+    }
+    if (failed) {
+        printf("Ignoring damaged cache entry %s\n", path);
+        free(buffer);
+        return -1;
+    }
+    *data = buffer;
+    return 0;
+}
+
+int framecache_load(const char* dir, uint64_t key, FrameLog* log) {
+    uint8_t* data;
+    size_t size;
+    if (cache_read_entry(dir, key, "ayc", &data, &size) != 0) return -1;
+
+    uint32_t count = size >= CACHE_HEADER_SIZE ? cache_get_u32(data + 20) : 0;
+    if (size < CACHE_HEADER_SIZE ||
+        memcmp(data, "AYFC", 4) != 0 ||
+        cache_get_u32(data + 4) != FRAME_CACHE_VERSION ||
+        cache_get_u64(data + 8) != key ||
+        size != CACHE_HEADER_SIZE + (size_t)count * sizeof(FrameRecord)) {
+        free(data);
+        return -1;
+    }
+
+    FrameRecord* frames = (FrameRecord*)malloc((count ? count : 1) * sizeof(FrameRecord));
+    if (!frames) {
+        free(data);
+        return -1;
+    }
+    memcpy(frames, data + CACHE_HEADER_SIZE, count * sizeof(FrameRecord));
+
+    framelog_free(log);
+    log->frames = frames;
+    log->count = log->capacity = count;
+    log->machine = cache_get_u32(data + 16);
+    free(data);
+    return 0;
+}
+
+int framecache_store(const char* dir, uint64_t key, const FrameLog* log) {
+    size_t size = CACHE_HEADER_SIZE + (size_t)log->count * sizeof(FrameRecord);
+    uint8_t* data = (uint8_t*)malloc(size);
+    if (!data) return -1;
+
+    memset(data, 0, CACHE_HEADER_SIZE);
+    memcpy(data, "AYFC", 4);
+    cache_put_u32(data + 4, FRAME_CACHE_VERSION);
+    cache_put_u64(data + 8, key);
+    cache_put_u32(data + 16, log->machine);
+    cache_put_u32(data + 20, log->count);
+    memcpy(data + CACHE_HEADER_SIZE, log->frames, log->count * sizeof(FrameRecord));
+
+    int failed = cache_write_entry(dir, key, "ayc", data, size);
+    free(data);
+    return failed;
+}
@@ -0,0 +1,70 @@
+/* framecache.h
+ * Persistent cache of emulated frame streams.
+ *
+ * An entry holds every frame a song produced, keyed by a hash of the AY file
+ * bytes, the song index, the cache version and the options that change
+ * emulation. Output options don't take part: on a hit the frames are fed to
+ * the sinks again, so any output format can be written without emulating.
+ */
+
+#ifndef __FRAMECACHE_INCLUDED__
+#define __FRAMECACHE_INCLUDED__
+
+#include "framering.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump whenever a change to the emulation changes the frames it produces
+#define FRAME_CACHE_VERSION 3
+
+typedef struct FrameLog {
+    FrameRecord* frames;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t machine;         // profile the frames were produced on
+} FrameLog;
+
+// Returns 0 on success, -1 on allocation failure
+int framelog_append(FrameLog* log, const uint8_t regs[16], int env_written);
+void framelog_free(FrameLog* log);
+
+// Make room for count frames in all, so appending them won't allocate.
+// Returns 0 on success, -1 on allocation failure.
+int framelog_reserve(FrameLog* log, uint32_t count);
+
+uint64_t framecache_key(uint64_t file_hash, int song_index, const char* options);
+
+// Returns 0 and fills log on a hit, -1 on a miss or a damaged entry
+int framecache_load(const char* dir, uint64_t key, FrameLog* log);
+
+// Returns 0 on success, -1 on failure
+int framecache_store(const char* dir, uint64_t key, const FrameLog* log);
+
+// Entry files, shared with the snapshot cache: "<dir>/<key>.<ext>" with a
+// checksum appended. They are written under a temporary name and renamed
+// into place, so concurrent runs sharing a cache never see a partial entry.
+int cache_write_entry(const char* dir, uint64_t key, const char* ext, const uint8_t* data, size_t size);
+
+// Returns 0 and a malloc'd copy of the data on success, -1 if the entry is
+// missing or damaged
+int cache_read_entry(const char* dir, uint64_t key, const char* ext, uint8_t** data, size_t* size);
+
+// Entries store integers little endian
+static inline void cache_put_u32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline void cache_put_u64(uint8_t* out, uint64_t value) {
+    cache_put_u32(out, (uint32_t)value);
+    cache_put_u32(out + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint32_t cache_get_u32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static inline uint64_t cache_get_u64(const uint8_t* in) {
+    return cache_get_u32(in) | ((uint64_t)cache_get_u32(in + 4) << 32);
+}
+
+#endif
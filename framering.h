@@ -0,0 +1,116 @@
+/* framering.h
+ * Lock-free single-producer single-consumer ring of AY register frames.
+ *
+ * The emulator pushes one record per frame, an output sink thread pops them.
+ * Head and tail live on separate cache lines so the two threads don't fight
+ * over them. A side that has to wait yields a few times and then sleeps on
+ * the ring's waiter until the other side moves; the other side only takes
+ * the waiter's lock when someone is asleep on it.
+ */
+
+#ifndef __FRAMERING_INCLUDED__
+#define __FRAMERING_INCLUDED__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+typedef struct FrameRecord {
+    uint8_t regs[16];         // AY registers sampled at the interrupt
+    uint8_t env_written;      // R13 was written during the frame
+} FrameRecord;
+
+// Where the threads of a ring or queue sleep while they can't go on
+typedef struct RingWaiter {
+    std::atomic<int> sleepers;
+    std::mutex lock;
+    std::condition_variable wake;
+} RingWaiter;
+
+typedef struct FrameRing {
+    alignas(64) std::atomic<size_t> head;   // next slot to write (producer)
+    alignas(64) std::atomic<size_t> tail;   // next slot to read (consumer)
+    alignas(64) std::atomic<int> closed;    // producer is done
+    FrameRecord* slots;
+    size_t mask;
+    RingWaiter waiter;
+} FrameRing;
+
+// Back off until ready() holds: yield a few times, then sleep until
+// ringwaiter_notify. ready() is checked again once the sleeper is counted,
+// so a notify between the caller's check and the sleep isn't lost.
+template <typename Ready>
+static inline void ringwaiter_wait(RingWaiter* waiter, unsigned* spins, Ready ready) {
+    if (++(*spins) < 64) {
+        std::this_thread::yield();
+        return;
+    }
+    std::unique_lock<std::mutex> guard(waiter->lock);
+    waiter->sleepers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!ready()) waiter->wake.wait(guard);
+    waiter->sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Wake the sleepers after making progress visible
+static inline void ringwaiter_notify(RingWaiter* waiter) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiter->sleepers.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard<std::mutex> guard(waiter->lock);
+        waiter->wake.notify_all();
+    }
+}
+
+// The ring uses the caller's slots, capacity must be a power of two
+static inline void framering_init(FrameRing* ring, FrameRecord* slots, size_t capacity) {
+    ring->slots = slots;
+    ring->mask = capacity - 1;
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->closed.store(0, std::memory_order_relaxed);
+    ring->waiter.sleepers.store(0, std::memory_order_relaxed);
+}
+
+// Producer side, blocks while the ring is full
+static inline void framering_push(FrameRing* ring, const FrameRecord* record) {
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    unsigned spins = 0;
+    auto has_room = [&] { return head - ring->tail.load(std::memory_order_acquire) <= ring->mask; };
+    while (!has_room()) {
+        ringwaiter_wait(&ring->waiter, &spins, has_room);
+    }
+    ring->slots[head & ring->mask] = *record;
+    ring->head.store(head + 1, std::memory_order_release);
+    ringwaiter_notify(&ring->waiter);
+}
+
+static inline void framering_close(FrameRing* ring) {
+    ring->closed.store(1, std::memory_order_release);
+    ringwaiter_notify(&ring->waiter);
+}
+
+// Consumer side, blocks until a record is available. Returns 0 once the
+// producer has closed the ring and everything has been read.
+static inline int framering_pop(FrameRing* ring, FrameRecord* record) {
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    unsigned spins = 0;
+    auto can_read = [&] {
+        return tail != ring->head.load(std::memory_order_acquire) || ring->closed.load(std::memory_order_acquire);
+    };
+    while (tail == ring->head.load(std::memory_order_acquire)) {
+        if (ring->closed.load(std::memory_order_acquire)) {
+            // Re-check, the last push may have raced with close
+            if (tail == ring->head.load(std::memory_order_acquire)) return 0;
+            break;
+        }
+        ringwaiter_wait(&ring->waiter, &spins, can_read);
+    }
+    *record = ring->slots[tail & ring->mask];
+    ring->tail.store(tail + 1, std::memory_order_release);
+    ringwaiter_notify(&ring->waiter);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/* hash.h
+ * 64-bit FNV-1a, used wherever a stable content hash is needed (cache keys).
+ * The value only depends on the bytes hashed, never on the platform.
+ */
+
+#ifndef __HASH_INCLUDED__
+#define __HASH_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH64_SEED 0xCBF29CE484222325ULL
+
+static inline uint64_t hash64(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Integers are hashed as little endian bytes so keys match across hosts
+static inline uint64_t hash64_u32(uint64_t hash, uint32_t value) {
+    uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+    return hash64(hash, bytes, 4);
+}
+
+static inline uint64_t hash64_u64(uint64_t hash, uint64_t value) {
+    hash = hash64_u32(hash, (uint32_t)value);
+    return hash64_u32(hash, (uint32_t)(value >> 32));
+}
+
+#endif
@@ -0,0 +1,514 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+// LHA -lh5- encoder: LZ77 with an 8KB window followed by static Huffman
+// blocks, following the layout of Haruhiko Okumura's ar002.
+
+#include "lha.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DICBIT 13
+#define DICSIZ (1 << DICBIT)
+#define MAXMATCH 256
+#define THRESHOLD 3
+#define NC (255 + MAXMATCH + 2 - THRESHOLD)  // literals + match lengths
+#define NP (DICBIT + 1)                      // position bit lengths
+#define NT 19                                // code length codes
+#define CBIT 9
+#define PBIT 4
+#define TBIT 5
+#define MAX_CODE_LEN 16
+
+#define HASH_BITS 14
+#define HASH_SIZE (1 << HASH_BITS)
+#define MAX_CHAIN 256
+#define BLOCK_ITEMS 0x4000
+
+typedef struct BitWriter {
+    unsigned char* buf;
+    size_t size;
+    size_t capacity;
+    uint32_t bitbuf;
+    int bitcount;
+    int error;
+} BitWriter;
+
+typedef struct Lh5Encoder {
+    BitWriter out;
+
+    // Pending block: literal/length codes and match positions
+    uint16_t items_c[BLOCK_ITEMS];
+    uint16_t items_p[BLOCK_ITEMS];
+    int item_count;
+
+    uint16_t c_freq[2 * NC - 1];
+    uint16_t p_freq[2 * NP - 1];
+    uint16_t t_freq[2 * NT - 1];
+    uint8_t c_len[NC];
+    uint16_t c_code[NC];
+    uint8_t pt_len[NT > NP ? NT : NP];
+    uint16_t pt_code[NT > NP ? NT : NP];
+
+    int32_t hash_head[HASH_SIZE];
+    int32_t hash_prev[DICSIZ];
+} Lh5Encoder;
+
+static void put_byte(BitWriter* bw, unsigned char byte) {
+    if (bw->error) return;
+    if (bw->size == bw->capacity) {
+        size_t new_capacity = bw->capacity ? bw->capacity * 2 : 4096;
+        unsigned char* new_buf = (unsigned char*)realloc(bw->buf, new_capacity);
+        if (!new_buf) {
+            bw->error = 1;
+            return;
+        }
+        bw->buf = new_buf;
+        bw->capacity = new_capacity;
+    }
+    bw->buf[bw->size++] = byte;
+}
+
+// Write the low n bits of x, most significant first (n <= 16)
+static void putbits(BitWriter* bw, int n, unsigned x) {
+    if (n == 0) return;
+    bw->bitbuf = (bw->bitbuf << n) | (x & ((1U << n) - 1));
+    bw->bitcount += n;
+    while (bw->bitcount >= 8) {
+        bw->bitcount -= 8;
+        put_byte(bw, (unsigned char)(bw->bitbuf >> bw->bitcount));
+    }
+    bw->bitbuf &= (1U << bw->bitcount) - 1;
+}
+
+static void flush_bits(BitWriter* bw) {
+    if (bw->bitcount > 0) {
+        put_byte(bw, (unsigned char)(bw->bitbuf << (8 - bw->bitcount)));
+        bw->bitcount = 0;
+        bw->bitbuf = 0;
+    }
+}
+
+// Canonical codes from code lengths
+static void make_code(int n, const uint8_t* len, uint16_t* code) {
+    uint16_t len_cnt[MAX_CODE_LEN + 1];
+    uint16_t start[MAX_CODE_LEN + 2];
+
+    memset(len_cnt, 0, sizeof(len_cnt));
+    for (int i = 0; i < n; i++) len_cnt[len[i]]++;
+
+    start[1] = 0;
+    for (int i = 1; i <= MAX_CODE_LEN; i++) {
+        start[i + 1] = (uint16_t)((start[i] + len_cnt[i]) << 1);
+    }
+    for (int i = 0; i < n; i++) {
+        code[i] = len[i] ? start[len[i]]++ : 0;
+    }
+}
+
+// Build Huffman code lengths limited to 16 bits. Returns the symbol itself if
+// fewer than two symbols are used (it then has a zero-length code), or n.
+static int make_tree(int n, const uint16_t* freq, uint8_t* len, uint16_t* code) {
+    int heap[NC + 1];
+    uint32_t weight[2 * NC];
+    int parent[2 * NC];
+    int sorted[NC];          // leaves in the order they leave the heap (ascending weight)
+    int heap_size = 0, sort_count = 0;
+
+    memset(len, 0, n);
+    for (int i = 0; i < n; i++) {
+        weight[i] = freq[i];
+        if (freq[i]) heap[++heap_size] = i;
+    }
+    if (heap_size < 2) {
+        int root = heap_size ? heap[1] : 0;
+        code[root] = 0;
+        return root;
+    }
+
+    // Min-heap on weight
+    #define HEAP_LESS(a, b) (weight[a] < weight[b] || (weight[a] == weight[b] && (a) < (b)))
+    for (int i = heap_size / 2; i >= 1; i--) {
+        int k = i, v = heap[k];
+        while (2 * k <= heap_size) {
+            int j = 2 * k;
+            if (j < heap_size && HEAP_LESS(heap[j + 1], heap[j])) j++;
+            if (!HEAP_LESS(heap[j], v)) break;
+            heap[k] = heap[j];
+            k = j;
+        }
+        heap[k] = v;
+    }
+
+    int avail = n;
+    while (heap_size > 1) {
+        int pick[2];
+        for (int m = 0; m < 2; m++) {
+            pick[m] = heap[1];
+            if (pick[m] < n) sorted[sort_count++] = pick[m];
+            heap[1] = heap[heap_size--];
+            int k = 1, v = heap[1];
+            while (2 * k <= heap_size) {
+                int j = 2 * k;
+                if (j < heap_size && HEAP_LESS(heap[j + 1], heap[j])) j++;
+                if (!HEAP_LESS(heap[j], v)) break;
+                heap[k] = heap[j];
+                k = j;
+            }
+            heap[k] = v;
+        }
+
+        int node = avail++;
+        weight[node] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = node;
+
+        // Insert the new node
+        int k = ++heap_size;
+        while (k > 1 && HEAP_LESS(node, heap[k / 2])) {
+            heap[k] = heap[k / 2];
+            k /= 2;
+        }
+        heap[k] = node;
+    }
+    #undef HEAP_LESS
+    int root = heap[1];
+
+    // Count leaves per depth, anything deeper than 16 is clamped
+    uint16_t len_cnt[MAX_CODE_LEN + 1];
+    memset(len_cnt, 0, sizeof(len_cnt));
+    for (int s = 0; s < sort_count; s++) {
+        int depth = 0;
+        for (int node = sorted[s]; node != root; node = parent[node]) depth++;
+        len_cnt[depth > MAX_CODE_LEN ? MAX_CODE_LEN : depth]++;
+    }
+
+    // Restore the Kraft equality after clamping
+    uint32_t cum = 0;
+    for (int i = MAX_CODE_LEN; i > 0; i--) {
+        cum += (uint32_t)len_cnt[i] << (MAX_CODE_LEN - i);
+    }
+    while (cum != (1U << MAX_CODE_LEN)) {
+        len_cnt[MAX_CODE_LEN]--;
+        for (int i = MAX_CODE_LEN - 1; i > 0; i--) {
+            if (len_cnt[i] != 0) {
+                len_cnt[i]--;
+                len_cnt[i + 1] += 2;
+                break;
+            }
+        }
+        cum--;
+    }
+
+    // Least frequent leaves get the longest codes
+    int s = 0;
+    for (int i = MAX_CODE_LEN; i > 0; i--) {
+        for (int k = 0; k < len_cnt[i]; k++) {
+            len[sorted[s++]] = (uint8_t)i;
+        }
+    }
+
+    make_code(n, len, code);
+    return root;
+}
+
+static void count_t_freq(Lh5Encoder* enc) {
+    int n = NC;
+    memset(enc->t_freq, 0, sizeof(enc->t_freq));
+    while (n > 0 && enc->c_len[n - 1] == 0) n--;
+
+    int i = 0;
+    while (i < n) {
+        int k = enc->c_len[i++];
+        if (k == 0) {
+            int count = 1;
+            while (i < n && enc->c_len[i] == 0) {
+                i++;
+                count++;
+            }
+            if (count <= 2) enc->t_freq[0] += (uint16_t)count;
+            else if (count <= 18) enc->t_freq[1]++;
+            else if (count == 19) {
+                enc->t_freq[0]++;
+                enc->t_freq[1]++;
+            }
+            else enc->t_freq[2]++;
+        }
+        else enc->t_freq[k + 2]++;
+    }
+}
+
+static void write_pt_len(Lh5Encoder* enc, int n, int nbit, int i_special) {
+    while (n > 0 && enc->pt_len[n - 1] == 0) n--;
+    putbits(&enc->out, nbit, n);
+
+    int i = 0;
+    while (i < n) {
+        int k = enc->pt_len[i++];
+        if (k <= 6) putbits(&enc->out, 3, k);
+        else putbits(&enc->out, k - 3, (1U << (k - 3)) - 2);
+
+        if (i == i_special) {
+            while (i < 6 && enc->pt_len[i] == 0) i++;
+            putbits(&enc->out, 2, (i - 3) & 3);
+        }
+    }
+}
+
+static void write_c_len(Lh5Encoder* enc) {
+    int n = NC;
+    while (n > 0 && enc->c_len[n - 1] == 0) n--;
+    putbits(&enc->out, CBIT, n);
+
+    int i = 0;
+    while (i < n) {
+        int k = enc->c_len[i++];
+        if (k == 0) {
+            int count = 1;
+            while (i < n && enc->c_len[i] == 0) {
+                i++;
+                count++;
+            }
+            if (count <= 2) {
+                for (k = 0; k < count; k++) putbits(&enc->out, enc->pt_len[0], enc->pt_code[0]);
+            }
+            else if (count <= 18) {
+                putbits(&enc->out, enc->pt_len[1], enc->pt_code[1]);
+                putbits(&enc->out, 4, count - 3);
+            }
+            else if (count == 19) {
+                putbits(&enc->out, enc->pt_len[0], enc->pt_code[0]);
+                putbits(&enc->out, enc->pt_len[1], enc->pt_code[1]);
+                putbits(&enc->out, 4, 15);
+            }
+            else {
+                putbits(&enc->out, enc->pt_len[2], enc->pt_code[2]);
+                putbits(&enc->out, CBIT, count - 20);
+            }
+        }
+        else putbits(&enc->out, enc->pt_len[k + 2], enc->pt_code[k + 2]);
+    }
+}
+
+static int bit_length(unsigned p) {
+    int c = 0;
+    while (p) {
+        p >>= 1;
+        c++;
+    }
+    return c;
+}
+
+static void send_block(Lh5Encoder* enc) {
+    if (enc->item_count == 0) return;
+
+    int root = make_tree(NC, enc->c_freq, enc->c_len, enc->c_code);
+    putbits(&enc->out, 16, enc->item_count);
+
+    if (root >= NC) {
+        count_t_freq(enc);
+        root = make_tree(NT, enc->t_freq, enc->pt_len, enc->pt_code);
+        if (root >= NT) {
+            write_pt_len(enc, NT, TBIT, 3);
+        }
+        else {
+            putbits(&enc->out, TBIT, 0);
+            putbits(&enc->out, TBIT, root);
+        }
+        write_c_len(enc);
+    }
+    else {
+        putbits(&enc->out, TBIT, 0);
+        putbits(&enc->out, TBIT, 0);
+        putbits(&enc->out, CBIT, 0);
+        putbits(&enc->out, CBIT, root);
+    }
+
+    root = make_tree(NP, enc->p_freq, enc->pt_len, enc->pt_code);
+    if (root >= NP) {
+        write_pt_len(enc, NP, PBIT, -1);
+    }
+    else {
+        putbits(&enc->out, PBIT, 0);
+        putbits(&enc->out, PBIT, root);
+    }
+
+    for (int i = 0; i < enc->item_count; i++) {
+        int c = enc->items_c[i];
+        putbits(&enc->out, enc->c_len[c], enc->c_code[c]);
+        if (c > 255) {
+            unsigned p = enc->items_p[i];
+            int bits = bit_length(p);
+            putbits(&enc->out, enc->pt_len[bits], enc->pt_code[bits]);
+            if (bits > 1) putbits(&enc->out, bits - 1, p & (0xFFFFU >> (17 - bits)));
+        }
+    }
+
+    enc->item_count = 0;
+    memset(enc->c_freq, 0, sizeof(enc->c_freq));
+    memset(enc->p_freq, 0, sizeof(enc->p_freq));
+}
+
+static void output_item(Lh5Encoder* enc, int c, unsigned p) {
+    enc->items_c[enc->item_count] = (uint16_t)c;
+    enc->items_p[enc->item_count] = (uint16_t)p;
+    enc->item_count++;
+    enc->c_freq[c]++;
+    if (c > 255) enc->p_freq[bit_length(p)]++;
+
+    if (enc->item_count == BLOCK_ITEMS) send_block(enc);
+}
+
+static unsigned hash3(const unsigned char* p) {
+    return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+static void insert_hash(Lh5Encoder* enc, const unsigned char* data, size_t size, size_t pos) {
+    if (pos + THRESHOLD > size) return;
+    unsigned h = hash3(data + pos);
+    enc->hash_prev[pos & (DICSIZ - 1)] = enc->hash_head[h];
+    enc->hash_head[h] = (int32_t)pos;
+}
+
+// Longest match for 'pos' among earlier positions, distance < DICSIZ
+static int find_match(Lh5Encoder* enc, const unsigned char* data, size_t size, size_t pos, size_t* match_pos) {
+    if (pos + THRESHOLD > size) return 0;
+
+    size_t max_len = size - pos;
+    if (max_len > MAXMATCH) max_len = MAXMATCH;
+
+    int best = 0;
+    int chain = MAX_CHAIN;
+    int32_t cand = enc->hash_head[hash3(data + pos)];
+
+    while (cand >= 0 && chain-- > 0) {
+        size_t c = (size_t)cand;
+        if (c >= pos || pos - c >= DICSIZ) break;
+
+        if (data[c + best] == data[pos + best]) {
+            size_t len = 0;
+            while (len < max_len && data[c + len] == data[pos + len]) len++;
+            if ((int)len > best) {
+                best = (int)len;
+                *match_pos = c;
+                if (len == max_len) break;
+            }
+        }
+
+        int32_t next = enc->hash_prev[c & (DICSIZ - 1)];
+        if (next >= cand) break;    // slot reused by a newer position
+        cand = next;
+    }
+    return best >= THRESHOLD ? best : 0;
+}
+
+static void compress(Lh5Encoder* enc, const unsigned char* data, size_t size) {
+    for (int i = 0; i < HASH_SIZE; i++) enc->hash_head[i] = -1;
+
+    size_t pos = 0;
+    while (pos < size) {
+        size_t match_pos = 0;
+        int len = find_match(enc, data, size, pos, &match_pos);
+
+        // Lazy evaluation: prefer a longer match starting at the next byte
+        if (len > 0 && len < MAXMATCH) {
+            size_t next_pos = 0;
+            insert_hash(enc, data, size, pos);
+            int next_len = find_match(enc, data, size, pos + 1, &next_pos);
+            if (next_len > len) {
+                output_item(enc, data[pos], 0);
+                pos++;
+                continue;
+            }
+            output_item(enc, len + 256 - THRESHOLD, (unsigned)(pos - match_pos - 1));
+            for (size_t i = pos + 1; i < pos + len; i++) insert_hash(enc, data, size, i);
+            pos += len;
+        }
+        else if (len > 0) {
+            output_item(enc, len + 256 - THRESHOLD, (unsigned)(pos - match_pos - 1));
+            for (size_t i = pos; i < pos + len; i++) insert_hash(enc, data, size, i);
+            pos += len;
+        }
+        else {
+            output_item(enc, data[pos], 0);
+            insert_hash(enc, data, size, pos);
+            pos++;
+        }
+    }
+
+    send_block(enc);
+    flush_bits(&enc->out);
+}
+
+// CRC-16 as used by LHA (polynomial 0xA001, reflected)
+static uint16_t crc16(const unsigned char* data, size_t size) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static void pack_uint32_le(uint32_t value, unsigned char* out) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+int lha_pack(const unsigned char* data, size_t size, const char* name,
+    unsigned char** out, size_t* out_size)
+{
+    Lh5Encoder* enc = (Lh5Encoder*)calloc(1, sizeof(Lh5Encoder));
+    if (!enc) return -1;
+
+    compress(enc, data, size);
+    if (enc->out.error) {
+        free(enc->out.buf);
+        free(enc);
+        return -1;
+    }
+
+    size_t name_len = strlen(name);
+    if (name_len > 230) name_len = 230;
+
+    // Level 0 header: size, checksum, method, sizes, DOS time, attribute,
+    // level, name, CRC. The timestamp is fixed so output is reproducible.
+    size_t header_len = 22 + name_len;
+    size_t total = 2 + header_len + enc->out.size + 1;
+    unsigned char* archive = (unsigned char*)malloc(total);
+    if (!archive) {
+        free(enc->out.buf);
+        free(enc);
+        return -1;
+    }
+
+    unsigned char* h = archive;
+    h[0] = (unsigned char)header_len;
+    memcpy(h + 2, "-lh5-", 5);
+    pack_uint32_le((uint32_t)enc->out.size, h + 7);
+    pack_uint32_le((uint32_t)size, h + 11);
+    pack_uint32_le(0x00210000, h + 15);     // 1980-01-01 00:00:00
+    h[19] = 0x20;
+    h[20] = 0;
+    h[21] = (unsigned char)name_len;
+    memcpy(h + 22, name, name_len);
+    uint16_t crc = crc16(data, size);
+    h[22 + name_len] = crc & 0xFF;
+    h[23 + name_len] = crc >> 8;
+
+    unsigned char checksum = 0;
+    for (size_t i = 2; i < 2 + header_len; i++) checksum += h[i];
+    h[1] = checksum;
+
+    memcpy(archive + 2 + header_len, enc->out.buf, enc->out.size);
+    archive[total - 1] = 0;   // end of archive
+
+    free(enc->out.buf);
+    free(enc);
+
+    *out = archive;
+    *out_size = total;
+    return 0;
+}
@@ -0,0 +1,18 @@
+/* lha.h
+ * Minimal LHA (-lh5-) archiver, used to write compressed YM files the way
+ * they are usually distributed.
+ */
+
+#ifndef __LHA_INCLUDED__
+#define __LHA_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compress 'data' into a single-file LHA level 0 archive stored under
+// 'name'. On success *out is a malloc'ed buffer owned by the caller.
+// Returns 0 on success, -1 on allocation failure.
+int lha_pack(const unsigned char* data, size_t size, const char* name,
+    unsigned char** out, size_t* out_size);
+
+#endif
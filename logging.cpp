@@ -0,0 +1,13 @@
+#include "logging.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+thread_local int log_quiet = 0;
+
+void log_printf(const char* format, ...) {
+    if (log_quiet) return;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
@@ -0,0 +1,18 @@
+/* logging.h
+ * Progress output that index and batch workers switch off.
+ *
+ * The switch is per thread, so a quiet batch worker and a converting main
+ * thread can run side by side. Sink threads take it over from the thread
+ * that starts them (sinkset_start). Errors are printed with printf either
+ * way.
+ */
+
+#ifndef __LOGGING_INCLUDED__
+#define __LOGGING_INCLUDED__
+
+extern thread_local int log_quiet;
+
+// printf unless the calling thread is quiet
+void log_printf(const char* format, ...);
+
+#endif
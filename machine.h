@@ -0,0 +1,100 @@
+/* machine.h
+ * Machines a song can be emulated on (--machine).
+ *
+ * A profile fixes the CPU clock, the number of CPU cycles between two
+ * interrupts (and so the frame rate) and the AY clock. The profiles are
+ * constexpr, and the frame loop in ay2ym.cpp is instantiated once per
+ * profile through machine_dispatch(), so the frame length is a constant
+ * there. That is all a profile specialises: port decoding and register
+ * masking are not part of it. Every profile decodes the Spectrum ports first
+ * and then the CPC ones, and cuts only writes through the CPC PPI to the
+ * register widths, as the converter always has, so a song's frames don't
+ * depend on which machine its ports were detected for. `ports` only says
+ * which protocol probing prefers on a tie.
+ *
+ * Adding a machine takes an entry in MachineProfileId and machine_profiles
+ * and a case in machine_dispatch().
+ */
+
+#ifndef __MACHINE_INCLUDED__
+#define __MACHINE_INCLUDED__
+
+#include "ay2ym.h"
+#include <stdint.h>
+
+// Machine probing (--detect probe, and songs the port scan can't place):
+// frames emulated, and AY sound registers one protocol must reach to count
+#define PROBE_FRAMES 50
+#define PROBE_MIN_REGISTERS 3
+
+typedef enum {
+    MACHINE_PORTS_SPECTRUM = 0,   // FFFD selects, BFFD writes
+    MACHINE_PORTS_CPC             // PPI port A on F4xx, control on F6xx
+} MachinePorts;
+
+typedef enum {
+    PROFILE_SPECTRUM_48 = 0,
+    PROFILE_SPECTRUM_128,
+    PROFILE_PENTAGON,
+    PROFILE_CPC,
+    PROFILE_COUNT
+} MachineProfileId;
+
+typedef struct MachineProfile {
+    const char* name;         // as given to --machine
+    const char* description;
+    uint32_t cpu_clock;       // Hz
+    uint32_t frame_tstates;   // CPU cycles from one interrupt to the next
+    uint32_t ay_clock;        // Hz
+    MachinePorts ports;       // protocol probing prefers on a tie (not used for decoding)
+} MachineProfile;
+
+// The 48K and CPC frames are the nominal 50 Hz ones the converter has always
+// used (a real 48K frame is 69888 cycles, a CPC one 79872), so their output
+// doesn't change
+constexpr MachineProfile machine_profiles[PROFILE_COUNT] = {
+    { "48k", "ZX Spectrum", 3500000, 70000, ZX_SPECTRUM_CLOCK, MACHINE_PORTS_SPECTRUM },
+    { "128k", "ZX Spectrum 128", 3546900, 70908, 1773450, MACHINE_PORTS_SPECTRUM },
+    { "pentagon", "Pentagon", 3500000, 71680, 1750000, MACHINE_PORTS_SPECTRUM },
+    { "cpc", "Amstrad CPC", 4000000, 80000, AMSTRAD_CPC_CLOCK, MACHINE_PORTS_CPC },
+};
+
+// Interrupts per second, rounded: what the YM and VGM headers take. The VGM
+// waits and the audio synthesis use the exact period.
+static inline uint32_t machine_frame_rate(const MachineProfile& profile) {
+    return (profile.cpu_clock + profile.frame_tstates / 2) / profile.frame_tstates;
+}
+
+// Profile for a machine found by the port scan
+static inline MachineProfileId machine_default_profile(MachineType type) {
+    return type == MACHINE_AMSTRAD_CPC ? PROFILE_CPC : PROFILE_SPECTRUM_48;
+}
+
+// Profile by --machine name, -1 if unknown
+static inline int machine_profile_from_name(const char* name) {
+    for (int i = 0; i < PROFILE_COUNT; i++) {
+        if (strcmp(machine_profiles[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+#ifdef __cplusplus
+// Compile-time handle on a profile
+template <int Id>
+struct MachineTag {
+    static constexpr int id = Id;
+};
+
+// Call f(MachineTag<id>()) with the profile as a compile-time constant
+template <typename F>
+static inline auto machine_dispatch(int id, F f) -> decltype(f(MachineTag<0>())) {
+    switch (id) {
+    case PROFILE_SPECTRUM_128: return f(MachineTag<PROFILE_SPECTRUM_128>());
+    case PROFILE_PENTAGON: return f(MachineTag<PROFILE_PENTAGON>());
+    case PROFILE_CPC: return f(MachineTag<PROFILE_CPC>());
+    default: return f(MachineTag<PROFILE_SPECTRUM_48>());
+    }
+}
+#endif
+
+#endif
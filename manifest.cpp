@@ -0,0 +1,181 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "manifest.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+int manifest_describe_output(const char* source, int song, const char* format,
+    const char* output, ManifestEntry* entry) {
+    FILE* f = fopen(output, "rb");
+    if (!f) return -1;
+
+    uint64_t hash = HASH64_SEED;
+    uint64_t size = 0;
+    uint8_t buffer[65536];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        hash = hash64(hash, buffer, got);
+        size += got;
+    }
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) return -1;
+
+    entry->source = source;
+    entry->song = song;
+    entry->format = format;
+    entry->size = size;
+    entry->hash = hash;
+    entry->output = output;
+    return 0;
+}
+
+static bool entry_less(const ManifestEntry& a, const ManifestEntry& b) {
+    if (a.source != b.source) return a.source < b.source;
+    if (a.song != b.song) return a.song < b.song;
+    return a.output < b.output;
+}
+
+static bool same_output(const ManifestEntry& a, const ManifestEntry& b) {
+    return a.source == b.source && a.song == b.song && a.output == b.output;
+}
+
+int manifest_write(const char* path, std::vector<ManifestEntry> entries) {
+    std::sort(entries.begin(), entries.end(), entry_less);
+
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        perror("Failed to create manifest");
+        return -1;
+    }
+
+    fprintf(out, "# ay2ym manifest %d\n", MANIFEST_VERSION);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const ManifestEntry& e = entries[i];
+        fprintf(out, "%s\t%d\t%s\t%llu\t%016llx\t%s\n", e.source.c_str(), e.song, e.format.c_str(),
+            (unsigned long long)e.size, (unsigned long long)e.hash, e.output.c_str());
+    }
+
+    if (fclose(out) != 0) {
+        perror("Failed to write manifest");
+        return -1;
+    }
+    return 0;
+}
+
+static int read_line(FILE* f, std::string* line) {
+    line->clear();
+    int c;
+    while ((c = fgetc(f)) != EOF && c != '\n') line->push_back((char)c);
+    return c != EOF || !line->empty();
+}
+
+// Split a line into exactly count tab separated fields
+static int split_fields(const std::string& line, std::string* fields, int count) {
+    size_t start = 0;
+    for (int i = 0; i < count; i++) {
+        size_t tab = line.find('\t', start);
+        if ((tab == std::string::npos) != (i == count - 1)) return -1;
+        fields[i] = line.substr(start, tab == std::string::npos ? std::string::npos : tab - start);
+        start = tab + 1;
+    }
+    return 0;
+}
+
+int manifest_read(const char* path, std::vector<ManifestEntry>* entries) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror("Failed to open manifest");
+        return -1;
+    }
+
+    std::string line;
+    int version = 0;
+    if (!read_line(f, &line) || sscanf(line.c_str(), "# ay2ym manifest %d", &version) != 1 ||
+        version != MANIFEST_VERSION) {
+        printf("%s: not a version %d manifest\n", path, MANIFEST_VERSION);
+        fclose(f);
+        return -1;
+    }
+
+    int line_number = 1;
+    while (read_line(f, &line)) {
+        line_number++;
+        std::string fields[6];
+        if (split_fields(line, fields, 6) != 0) {
+            printf("%s:%d: malformed line\n", path, line_number);
+            fclose(f);
+            return -1;
+        }
+
+        ManifestEntry entry;
+        entry.source = fields[0];
+        entry.song = atoi(fields[1].c_str());
+        entry.format = fields[2];
+        entry.size = strtoull(fields[3].c_str(), NULL, 10);
+        entry.hash = strtoull(fields[4].c_str(), NULL, 16);
+        entry.output = fields[5];
+        entries->push_back(entry);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int manifest_compare(std::vector<ManifestEntry> expected, std::vector<ManifestEntry> actual, FILE* report) {
+    std::sort(expected.begin(), expected.end(), entry_less);
+    std::sort(actual.begin(), actual.end(), entry_less);
+
+    int differences = 0;
+    size_t i = 0, j = 0;
+    while (i < expected.size() || j < actual.size()) {
+        if (j == actual.size() || (i < expected.size() && entry_less(expected[i], actual[j]))) {
+            const ManifestEntry& e = expected[i++];
+            fprintf(report, "missing: %s #%d %s %s\n", e.source.c_str(), e.song, e.format.c_str(), e.output.c_str());
+            differences++;
+        }
+        else if (i == expected.size() || entry_less(actual[j], expected[i])) {
+            const ManifestEntry& a = actual[j++];
+            fprintf(report, "new: %s #%d %s %s\n", a.source.c_str(), a.song, a.format.c_str(), a.output.c_str());
+            differences++;
+        }
+        else {
+            const ManifestEntry& e = expected[i++];
+            const ManifestEntry& a = actual[j++];
+            if (e.hash != a.hash || e.size != a.size || e.format != a.format) {
+                fprintf(report, "changed: %s #%d %s %s (size %llu -> %llu, hash %016llx -> %016llx)\n",
+                    a.source.c_str(), a.song, a.format.c_str(), a.output.c_str(), (unsigned long long)e.size,
+                    (unsigned long long)a.size, (unsigned long long)e.hash, (unsigned long long)a.hash);
+                differences++;
+            }
+        }
+    }
+    return differences;
+}
+
+int manifest_merge(const char* out_path, const char* const* inputs, int count) {
+    std::vector<ManifestEntry> entries;
+    for (int i = 0; i < count; i++) {
+        if (manifest_read(inputs[i], &entries) != 0) return -1;
+    }
+
+    // Shards may overlap (a rerun node, a manifest given twice); identical
+    // duplicates collapse, different ones mean the runs didn't agree
+    std::stable_sort(entries.begin(), entries.end(), entry_less);
+    std::vector<ManifestEntry> merged;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!merged.empty() && same_output(merged.back(), entries[i])) {
+            if (merged.back().hash != entries[i].hash || merged.back().size != entries[i].size) {
+                printf("Shards disagree about %s\n", entries[i].output.c_str());
+                return -1;
+            }
+            continue;
+        }
+        merged.push_back(entries[i]);
+    }
+
+    return manifest_write(out_path, merged);
+}
@@ -0,0 +1,51 @@
+/* manifest.h
+ * List of the outputs written by a batch run (--manifest), and the merge of
+ * the manifests written by the shards of a distributed run (--merge).
+ *
+ * Text, one output per line after a "# ay2ym manifest <version>" line:
+ *   source path, song index, format, size, content hash (16 hex digits),
+ *   output path
+ * separated by tabs. Lines are sorted by source path, song and output path
+ * and nothing depends on timing or on the machine, so the manifest of a run
+ * is the same however its songs were spread over workers or shards.
+ */
+
+#ifndef __MANIFEST_INCLUDED__
+#define __MANIFEST_INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define MANIFEST_VERSION 1
+
+typedef struct ManifestEntry {
+    std::string source;
+    int song;
+    std::string format;
+    uint64_t size;
+    uint64_t hash;            // hash64 of the output bytes
+    std::string output;
+} ManifestEntry;
+
+// Hash an output file that has just been written and describe it in entry.
+// Returns 0 on success, -1 if the file doesn't exist (sinks delete empty
+// outputs) or can't be read.
+int manifest_describe_output(const char* source, int song, const char* format,
+    const char* output, ManifestEntry* entry);
+
+// Returns 0 on success, -1 on failure
+int manifest_write(const char* path, std::vector<ManifestEntry> entries);
+int manifest_read(const char* path, std::vector<ManifestEntry>* entries);
+
+// Compare the entries of a run with a stored manifest, reporting every
+// output that changed, is missing or is new. Returns the number of
+// differences.
+int manifest_compare(std::vector<ManifestEntry> expected, std::vector<ManifestEntry> actual, FILE* report);
+
+// Combine shard manifests. An output listed by more than one shard must be
+// identical in all of them. Returns 0 on success, -1 on failure.
+int manifest_merge(const char* out_path, const char* const* inputs, int count);
+
+#endif
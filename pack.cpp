@@ -0,0 +1,391 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "pack.h"
+#include "hash.h"
+#include "serialize.h"
+#include <string.h>
+#include <algorithm>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int seek_to(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static bool entry_less(const PackEntry& a, const PackEntry& b) {
+    if (a.source != b.source) return a.source < b.source;
+    if (a.song != b.song) return a.song < b.song;
+    return a.name < b.name;
+}
+
+static void header_bytes(uint8_t* out, uint64_t index_offset, uint32_t count) {
+    std::vector<uint8_t> header = { 'A', 'Y', 'P', 'K' };
+    put_u32(header, PACK_VERSION);
+    put_u64(header, index_offset);
+    put_u32(header, count);
+    put_u32(header, 0);
+    memcpy(out, header.data(), PACK_HEADER_SIZE);
+}
+
+//
+// Writing
+//
+
+// One queued output
+typedef struct PackItem {
+    PackEntry entry;
+    uint8_t* data;
+} PackItem;
+
+static void sync_file(FILE* file) {
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+static void flush_buffer(PackWriter* pack) {
+    if (pack->buffer.empty()) return;
+    if (fwrite(pack->buffer.data(), 1, pack->buffer.size(), pack->file) != pack->buffer.size()) {
+        pack->failed = 1;
+    }
+    pack->unsynced += pack->buffer.size();
+    pack->buffer.clear();
+
+    if (pack->unsynced >= PACK_SYNC_BYTES) {
+        if (fflush(pack->file) != 0) pack->failed = 1;
+        sync_file(pack->file);
+        pack->unsynced = 0;
+    }
+}
+
+static void pack_writer_thread(PackWriter* pack) {
+    void* next;
+    while (workqueue_pop(&pack->queue, &next)) {
+        PackItem* item = (PackItem*)next;
+        if (pack->buffer.size() + item->entry.length > PACK_WRITE_BUFFER) flush_buffer(pack);
+
+        item->entry.offset = pack->offset;
+        pack->offset += item->entry.length;
+        if (item->entry.length >= PACK_WRITE_BUFFER) {
+            // Too big to gather, goes out directly
+            if (fwrite(item->data, 1, (size_t)item->entry.length, pack->file) != item->entry.length) pack->failed = 1;
+            pack->unsynced += item->entry.length;
+        }
+        else {
+            pack->buffer.insert(pack->buffer.end(), item->data, item->data + item->entry.length);
+        }
+        pack->entries.push_back(item->entry);
+
+        free(item->data);
+        delete item;
+    }
+    flush_buffer(pack);
+}
+
+int pack_create(PackWriter* pack, const char* path) {
+    pack->file = fopen(path, "wb");
+    if (!pack->file) {
+        perror("Failed to create pack");
+        return -1;
+    }
+
+    // Index offset 0 marks a pack that was never closed
+    uint8_t header[PACK_HEADER_SIZE];
+    header_bytes(header, 0, 0);
+    pack->failed = fwrite(header, 1, PACK_HEADER_SIZE, pack->file) != PACK_HEADER_SIZE;
+    pack->offset = PACK_HEADER_SIZE;
+    pack->unsynced = 0;
+    pack->entries.clear();
+    pack->buffer.clear();
+    pack->buffer.reserve(PACK_WRITE_BUFFER);
+
+    if (pack->failed || workqueue_init(&pack->queue, PACK_QUEUE_SIZE) != 0) {
+        fclose(pack->file);
+        pack->file = NULL;
+        return -1;
+    }
+    pack->writer = std::thread(pack_writer_thread, pack);
+    return 0;
+}
+
+int pack_append(PackWriter* pack, const char* source, int song, const char* name,
+    const char* format, const uint8_t* data, uint64_t length) {
+    PackItem* item = new PackItem;
+    item->entry.source = source;
+    item->entry.song = song;
+    item->entry.name = name;
+    item->entry.format = format;
+    item->entry.offset = 0;
+    item->entry.length = length;
+    item->entry.hash = hash64(HASH64_SEED, data, (size_t)length);
+    item->data = (uint8_t*)malloc(length ? (size_t)length : 1);
+    if (!item->data) {
+        delete item;
+        return -1;
+    }
+    memcpy(item->data, data, (size_t)length);
+
+    workqueue_push(&pack->queue, item);
+    return pack->failed ? -1 : 0;
+}
+
+int pack_close(PackWriter* pack) {
+    workqueue_close(&pack->queue);
+    pack->writer.join();
+    workqueue_free(&pack->queue);
+
+    std::sort(pack->entries.begin(), pack->entries.end(), entry_less);
+
+    std::vector<uint8_t> index;
+    for (size_t i = 0; i < pack->entries.size(); i++) {
+        const PackEntry& e = pack->entries[i];
+        put_string(index, e.source);
+        put_u32(index, (uint32_t)e.song);
+        put_string(index, e.name);
+        put_string(index, e.format);
+        put_u64(index, e.offset);
+        put_u64(index, e.length);
+        put_u64(index, e.hash);
+    }
+    if (fwrite(index.data(), 1, index.size(), pack->file) != index.size()) pack->failed = 1;
+
+    uint8_t header[PACK_HEADER_SIZE];
+    header_bytes(header, pack->offset, (uint32_t)pack->entries.size());
+    if (seek_to(pack->file, 0) != 0 || fwrite(header, 1, PACK_HEADER_SIZE, pack->file) != PACK_HEADER_SIZE) {
+        pack->failed = 1;
+    }
+
+    if (fflush(pack->file) != 0) pack->failed = 1;
+    sync_file(pack->file);
+    if (fclose(pack->file) != 0) pack->failed = 1;
+    pack->file = NULL;
+    if (pack->failed) printf("Failed to write pack\n");
+    return pack->failed ? -1 : 0;
+}
+
+//
+// Reading
+//
+
+static int map_file(PackReader* pack, const char* path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return -1;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return -1;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return -1;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return -1;
+    }
+    pack->file_handle = file;
+    pack->mapping_handle = mapping;
+    pack->data = (const uint8_t*)view;
+    pack->size = (uint64_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return -1;
+    pack->data = (const uint8_t*)view;
+    pack->size = (uint64_t)st.st_size;
+#endif
+    return 0;
+}
+
+void pack_release(PackReader* pack) {
+    if (pack->data) {
+#ifdef _WIN32
+        UnmapViewOfFile(pack->data);
+        CloseHandle((HANDLE)pack->mapping_handle);
+        CloseHandle((HANDLE)pack->file_handle);
+#else
+        munmap((void*)pack->data, (size_t)pack->size);
+#endif
+    }
+    pack->data = NULL;
+    pack->size = 0;
+    pack->entries.clear();
+}
+
+// Bounds checked reader over the mapped index
+typedef struct IndexCursor {
+    const uint8_t* pos;
+    const uint8_t* end;
+    int failed;
+} IndexCursor;
+
+static uint64_t get_uint(IndexCursor* c, int bytes) {
+    if (c->end - c->pos < bytes) {
+        c->failed = 1;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) value |= (uint64_t)c->pos[i] << (8 * i);
+    c->pos += bytes;
+    return value;
+}
+
+static std::string get_string(IndexCursor* c) {
+    size_t length = (size_t)get_uint(c, 2);
+    if ((size_t)(c->end - c->pos) < length) {
+        c->failed = 1;
+        return std::string();
+    }
+    std::string text((const char*)c->pos, length);
+    c->pos += length;
+    return text;
+}
+
+int pack_open(PackReader* pack, const char* path) {
+    pack->data = NULL;
+    pack->size = 0;
+    pack->entries.clear();
+    if (map_file(pack, path) != 0) {
+        printf("Can't open pack '%s'\n", path);
+        return -1;
+    }
+
+    IndexCursor c = { pack->data, pack->data + pack->size, 0 };
+    int valid = pack->size >= PACK_HEADER_SIZE && memcmp(pack->data, "AYPK", 4) == 0;
+    c.pos += 4;
+    uint32_t version = (uint32_t)get_uint(&c, 4);
+    uint64_t index_offset = get_uint(&c, 8);
+    uint32_t count = (uint32_t)get_uint(&c, 4);
+    if (!valid || version != PACK_VERSION || index_offset < PACK_HEADER_SIZE || index_offset > pack->size) {
+        printf("%s: not a version %d pack, or not closed\n", path, PACK_VERSION);
+        pack_release(pack);
+        return -1;
+    }
+
+    c.pos = pack->data + index_offset;
+    for (uint32_t i = 0; i < count && !c.failed; i++) {
+        PackEntry e;
+        e.source = get_string(&c);
+        e.song = (int)get_uint(&c, 4);
+        e.name = get_string(&c);
+        e.format = get_string(&c);
+        e.offset = get_uint(&c, 8);
+        e.length = get_uint(&c, 8);
+        e.hash = get_uint(&c, 8);
+        if (e.offset > index_offset || e.length > index_offset - e.offset) c.failed = 1;
+        pack->entries.push_back(e);
+    }
+    if (c.failed) {
+        printf("%s: damaged pack index\n", path);
+        pack_release(pack);
+        return -1;
+    }
+    return 0;
+}
+
+int pack_find(const PackReader* pack, const char* name) {
+    for (size_t i = 0; i < pack->entries.size(); i++) {
+        if (pack->entries[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+int pack_extract(const PackReader* pack, int index) {
+    const PackEntry& e = pack->entries[index];
+    FILE* out = fopen(e.name.c_str(), "wb");
+    if (!out) {
+        printf("Can't create '%s'\n", e.name.c_str());
+        return -1;
+    }
+    int failed = fwrite(pack->data + e.offset, 1, (size_t)e.length, out) != e.length;
+    if (fclose(out) != 0) failed = 1;
+    if (failed) printf("Failed to write '%s'\n", e.name.c_str());
+    return failed ? -1 : 0;
+}
+
+int pack_is_pack(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    char magic[4];
+    int is_pack = fread(magic, 1, 4, f) == 4 && memcmp(magic, "AYPK", 4) == 0;
+    fclose(f);
+    return is_pack;
+}
+
+//
+// Merging
+//
+
+typedef struct MergeItem {
+    const PackEntry* entry;
+    const PackReader* pack;
+} MergeItem;
+
+int pack_merge(const char* out_path, const char* const* inputs, int count) {
+    std::vector<PackReader> packs(count);
+    int failed = 0;
+    for (int i = 0; i < count && !failed; i++) {
+        if (pack_open(&packs[i], inputs[i]) != 0) failed = 1;
+    }
+
+    std::vector<MergeItem> items;
+    for (int i = 0; i < count && !failed; i++) {
+        for (size_t k = 0; k < packs[i].entries.size(); k++) {
+            MergeItem item = { &packs[i].entries[k], &packs[i] };
+            items.push_back(item);
+        }
+    }
+    std::stable_sort(items.begin(), items.end(), [](const MergeItem& a, const MergeItem& b) {
+        return entry_less(*a.entry, *b.entry);
+    });
+
+    PackWriter out;
+    if (!failed && pack_create(&out, out_path) != 0) failed = 1;
+    if (!failed) {
+        const PackEntry* last = NULL;
+        for (size_t i = 0; i < items.size() && !failed; i++) {
+            const PackEntry* e = items[i].entry;
+            if (last && last->source == e->source && last->song == e->song && last->name == e->name) {
+                if (last->hash != e->hash || last->length != e->length) {
+                    printf("Shards disagree about %s\n", e->name.c_str());
+                    failed = 1;
+                }
+                continue;
+            }
+            last = e;
+            if (pack_append(&out, e->source.c_str(), e->song, e->name.c_str(), e->format.c_str(),
+                items[i].pack->data + e->offset, e->length) != 0) {
+                failed = 1;
+            }
+        }
+        if (pack_close(&out) != 0) failed = 1;
+    }
+
+    for (int i = 0; i < count; i++) pack_release(&packs[i]);
+    return failed ? -1 : 0;
+}
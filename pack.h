@@ -0,0 +1,101 @@
+/* pack.h
+ * Single-file output pack (--pack), an alternative to one small file per
+ * song and format.
+ *
+ * Outputs are appended as they are finished, the index goes at the end and
+ * the header is patched when the pack is closed. Readers map the whole file
+ * and find entries through the index, so any output can be read without
+ * touching the rest.
+ *
+ * Layout, integers little endian, strings as u16 length + bytes:
+ *   header: "AYPK", u32 version, u64 index offset, u32 entry count,
+ *           u32 reserved (0)
+ *   data:   output files, back to back
+ *   index:  per entry: source path, u32 song index, output name, format,
+ *           u64 offset, u64 length, u64 content hash (hash64)
+ * Index entries are sorted by source path, song and output name. Data is in
+ * the order outputs were finished, except in merged packs, which store it
+ * in index order and are therefore the same however the work was split.
+ *
+ * Appends go through a queue to a writer thread, which gathers them into
+ * large writes and syncs the file every PACK_SYNC_BYTES rather than per
+ * output, so the converting threads never wait for the disk.
+ */
+
+#ifndef __PACK_INCLUDED__
+#define __PACK_INCLUDED__
+
+#include "workqueue.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 24
+#define PACK_QUEUE_SIZE 256                   // outputs waiting for the writer
+#define PACK_WRITE_BUFFER (4 * 1024 * 1024)   // bytes gathered per write
+#define PACK_SYNC_BYTES (64 * 1024 * 1024)    // bytes written between syncs
+
+typedef struct PackEntry {
+    std::string source;       // AY file the output was made from
+    int song;
+    std::string name;         // file name the output would have had
+    std::string format;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t hash;
+} PackEntry;
+
+typedef struct PackWriter {
+    FILE* file;
+    uint64_t offset;
+    std::vector<PackEntry> entries;     // owned by the writer thread until close
+    WorkQueue queue;                    // PackItems from the batch workers
+    std::thread writer;
+    std::vector<uint8_t> buffer;        // pending bytes, written in one go
+    uint64_t unsynced;
+    std::atomic<int> failed;
+} PackWriter;
+
+typedef struct PackReader {
+    const uint8_t* data;
+    uint64_t size;
+    std::vector<PackEntry> entries;
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#endif
+} PackReader;
+
+// Returns 0 on success, -1 if the pack can't be created
+int pack_create(PackWriter* pack, const char* path);
+
+// Queue one output, copying the data. Safe to call from several threads.
+// Returns 0, or -1 if an earlier write already failed.
+int pack_append(PackWriter* pack, const char* source, int song, const char* name,
+    const char* format, const uint8_t* data, uint64_t length);
+
+// Write everything queued, the index and the header, and sync. Returns 0 on
+// success, -1 on failure.
+int pack_close(PackWriter* pack);
+
+// Map a pack and read its index. Returns 0 on success, -1 on failure.
+int pack_open(PackReader* pack, const char* path);
+void pack_release(PackReader* pack);
+
+// Index of the entry with this output name, or -1
+int pack_find(const PackReader* pack, const char* name);
+
+// Write one entry to its output name. Returns 0 on success, -1 on failure.
+int pack_extract(const PackReader* pack, int index);
+
+// Non-zero if the file starts with the pack signature
+int pack_is_pack(const char* path);
+
+// Combine shard packs into one. An output found in more than one input must
+// be identical in all of them. Returns 0 on success, -1 on failure.
+int pack_merge(const char* out_path, const char* const* inputs, int count);
+
+#endif
@@ -0,0 +1,46 @@
+#include "players.h"
+#include "hash.h"
+#include <stddef.h>
+
+// Hash of length bytes of code at address, with the wildcard bytes as 0
+static uint64_t code_hash(const uint8_t* memory, uint16_t address, int length, uint64_t wildcards) {
+    uint64_t hash = HASH64_SEED;
+    for (int i = 0; i < length; i++) {
+        uint8_t byte = (wildcards >> i) & 1 ? 0 : memory[(uint16_t)(address + i)];
+        hash = hash64(hash, &byte, 1);
+    }
+    return hash;
+}
+
+//
+// Registry. The players of the synthetic corpus (aycorpus.cpp) share their
+// play routine; the IM 1 one is called at the interrupt address, the IM 2
+// and busy-wait ones set their interrupts up in init. Masked out are the
+// row pointer, row table, frame flag, handler and routine addresses.
+//
+
+static const KnownPlayer known_players[] = {
+    { "ay2ym corpus IM 1 player",
+        7, 0x36ULL, 0x48883D460FEBD149ULL,
+        42, 0x1B01B000186ULL, 0x4269E6019EDC30DCULL },
+    { "ay2ym corpus IM 2 player",
+        35, 0x6000036ULL, 0x67AC60BFF9194549ULL,
+        0, 0, 0 },
+    { "ay2ym corpus busy-wait player",
+        35, 0x1B06001B6ULL, 0x4F11DC300612859FULL,
+        0, 0, 0 },
+};
+
+const KnownPlayer* player_identify(const uint8_t* memory, uint16_t init, uint16_t interrupt) {
+    for (size_t i = 0; i < sizeof(known_players) / sizeof(known_players[0]); i++) {
+        const KnownPlayer* player = &known_players[i];
+        if ((player->play_length != 0) != (interrupt != 0)) continue;
+        if (code_hash(memory, init, player->init_length, player->init_wildcards) != player->init_hash) continue;
+        if (player->play_length &&
+            code_hash(memory, interrupt, player->play_length, player->play_wildcards) != player->play_hash) {
+            continue;
+        }
+        return player;
+    }
+    return NULL;
+}
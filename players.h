@@ -0,0 +1,35 @@
+/* players.h
+ * Known player routines, recognised by code fingerprint.
+ *
+ * A song's player is recognised by hashes of the code load_blocks left at
+ * its init and interrupt addresses, with the bytes that differ from song to
+ * song (the addresses of its data) masked out. Recognition only names the
+ * player, for the log and the index: every song is emulated, known player
+ * or not.
+ */
+
+#ifndef __PLAYERS_INCLUDED__
+#define __PLAYERS_INCLUDED__
+
+#include <stdint.h>
+
+typedef struct KnownPlayer {
+    const char* name;
+
+    // Code at the init and interrupt addresses: bytes hashed, the ones
+    // masked out (bit i for byte i) and the expected hash64(). A player
+    // with no interrupt code (play_length 0) sets up its own interrupts,
+    // and its songs have no interrupt address.
+    uint8_t init_length;
+    uint64_t init_wildcards;
+    uint64_t init_hash;
+    uint8_t play_length;
+    uint64_t play_wildcards;
+    uint64_t play_hash;
+} KnownPlayer;
+
+// The player of a song loaded into memory (before the AY stub is set up),
+// NULL if it isn't known
+const KnownPlayer* player_identify(const uint8_t* memory, uint16_t init, uint16_t interrupt);
+
+#endif
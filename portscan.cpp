@@ -0,0 +1,99 @@
+#include "portscan.h"
+
+// Pick the widest vector unit the compiler targets. The x64 ABI always has SSE2.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PORTSCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PORTSCAN_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline int lowest_bit(uint32_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// OUT (C),r for r = B, C, D, E, H, L, A
+static int is_out_c(uint8_t operand) {
+    return operand == 0x41 || operand == 0x49 || operand == 0x51 ||
+        operand == 0x59 || operand == 0x61 || operand == 0x69 ||
+        operand == 0x79;
+}
+
+// Decode the candidate at block[i]; i + 3 is inside the block
+static inline void check_candidate(const uint8_t* block, size_t i, MachineDetectionResult* result) {
+    if (block[i] == 0xED) {
+        if (!is_out_c(block[i + 1])) return;
+        uint16_t port = (uint16_t)((block[i + 3] << 8) | block[i + 2]);
+        if ((port & 0xFF00) == 0xFD00) {
+            result->spectrum_port_count++;
+        }
+        else if ((port >> 8) < 0xF0) {
+            // CPC 4MB extension ports
+            result->cpc_port_count++;
+        }
+        else {
+            result->undetected_port_count++;
+        }
+    }
+    else if (block[i] == 0xD3) {
+        uint8_t port = block[i + 1];
+        int detected = 0;
+        if (port == 0xFD || port == 0xBB) {
+            result->spectrum_port_count++;
+            detected = 1;
+        }
+        if ((port & CPC_PORT_MASK) == (0xF4 & CPC_PORT_MASK) ||
+            (port & CPC_PORT_MASK) == (0xF6 & CPC_PORT_MASK)) {
+            result->cpc_port_count++;
+            detected = 1;
+        }
+        if (port == 0xFE) {
+            result->ula_port_count++;
+            detected = 1;
+        }
+        if (!detected) result->undetected_port_count++;
+    }
+}
+
+void portscan_block(const uint8_t* block, size_t length, MachineDetectionResult* result) {
+    if (length <= 3) return;
+    const size_t count = length - 3;   // positions with a whole OUT (C),r and port after them
+    size_t i = 0;
+
+#if defined(PORTSCAN_AVX2)
+    const __m256i ed = _mm256_set1_epi8((char)0xED);
+    const __m256i d3 = _mm256_set1_epi8((char)0xD3);
+    for (; i + 32 <= count; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(block + i));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, ed), _mm256_cmpeq_epi8(bytes, d3));
+        for (uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits); mask; mask &= mask - 1) {
+            check_candidate(block, i + lowest_bit(mask), result);
+        }
+    }
+#elif defined(PORTSCAN_SSE2)
+    const __m128i ed = _mm_set1_epi8((char)0xED);
+    const __m128i d3 = _mm_set1_epi8((char)0xD3);
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(block + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, ed), _mm_cmpeq_epi8(bytes, d3));
+        for (uint32_t mask = (uint32_t)_mm_movemask_epi8(hits); mask; mask &= mask - 1) {
+            check_candidate(block, i + lowest_bit(mask), result);
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        if (block[i] == 0xED || block[i] == 0xD3) check_candidate(block, i, result);
+    }
+}
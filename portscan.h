@@ -0,0 +1,21 @@
+/* portscan.h
+ * Static AY port scan of loaded blocks, used to guess the machine.
+ *
+ * Every OUT (C),r and OUT (n),A opcode in a block is looked at: the bytes
+ * after OUT (C),r are read as the port, the operand of OUT (n),A as its low
+ * byte, and each one votes Spectrum, CPC or ULA. Candidate opcode bytes
+ * (0xED, 0xD3) are found 16 or 32 at a time with SSE2 or AVX2 when the
+ * compiler targets them, and only those positions are decoded.
+ */
+
+#ifndef __PORTSCAN_INCLUDED__
+#define __PORTSCAN_INCLUDED__
+
+#include "ay2ym.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Add the port writes found in block to the counts in result
+void portscan_block(const uint8_t* block, size_t length, MachineDetectionResult* result);
+
+#endif
@@ -0,0 +1,221 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "profile.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+#define INTERRUPT_TARGET 0x10000
+
+Profiler* profiler_create() {
+    Profiler* profiler = new (std::nothrow) Profiler;
+    if (!profiler) return NULL;
+    memset(profiler->counts, 0, sizeof(profiler->counts));
+    memset(profiler->cycles, 0, sizeof(profiler->cycles));
+    ProfileNode root = { -1, -1, 0 };
+    profiler->nodes.push_back(root);
+    profiler->depth = 0;
+    profiler->has_last = 0;
+    profiler->last_charged = 0;
+    profiler->last_pc = 0;
+    profiler->last_cycles = 0;
+    profiler->pending_interrupt = 0;
+    profiler->current_frame_cycles = 0;
+    return profiler;
+}
+
+void profiler_destroy(Profiler* profiler) {
+    delete profiler;
+}
+
+static int current_node(const Profiler* profiler) {
+    return profiler->depth ? profiler->stack[profiler->depth - 1].node : 0;
+}
+
+static void charge(Profiler* profiler, int cycles) {
+    profiler->cycles[profiler->last_pc] += cycles;
+    profiler->nodes[current_node(profiler)].cycles += cycles;
+    profiler->current_frame_cycles += cycles;
+}
+
+static void push_frame(Profiler* profiler, int target, uint16_t sp) {
+    int parent = current_node(profiler);
+    uint64_t key = ((uint64_t)parent << 20) | (uint32_t)target;
+    int node;
+    std::unordered_map<uint64_t, int>::iterator found = profiler->node_index.find(key);
+    if (found != profiler->node_index.end()) {
+        node = found->second;
+    }
+    else {
+        node = (int)profiler->nodes.size();
+        ProfileNode entry = { parent, target, 0 };
+        profiler->nodes.push_back(entry);
+        profiler->node_index[key] = node;
+    }
+
+    // Runaway recursion: keep the outermost frames
+    if (profiler->depth == PROFILE_MAX_DEPTH) return;
+    profiler->stack[profiler->depth].node = node;
+    profiler->stack[profiler->depth].entry_sp = sp;
+    profiler->depth++;
+}
+
+static void unwind(Profiler* profiler, uint16_t sp) {
+    while (profiler->depth && profiler->stack[profiler->depth - 1].entry_sp < sp) profiler->depth--;
+}
+
+// How the previous instruction moved the call stack, judged by where the
+// CPU went next
+static void track_calls(Profiler* profiler, const uint8_t* memory, int address, uint16_t sp) {
+    int last = profiler->last_pc;
+    uint8_t op = memory[last];
+
+    if (op == 0xCD || (op & 0xC7) == 0xC4) {
+        // CALL nn, CALL cc,nn
+        if (address != ((last + 3) & 0xFFFF)) push_frame(profiler, address, sp);
+    }
+    else if ((op & 0xC7) == 0xC7) {
+        // RST n
+        push_frame(profiler, address, sp);
+    }
+    else if (op == 0xC9 || (op & 0xC7) == 0xC0) {
+        // RET, RET cc
+        if (address != ((last + 1) & 0xFFFF)) unwind(profiler, sp);
+    }
+    else if (op == 0xED && (memory[(last + 1) & 0xFFFF] & 0xC7) == 0x45) {
+        // RETN, RETI
+        unwind(profiler, sp);
+    }
+}
+
+void profiler_instruction(Profiler* profiler, const Z80_STATE* state, const uint8_t* memory,
+    int address, int cycles) {
+    address &= 0xFFFF;
+    uint16_t sp = (uint16_t)state->registers.word[Z80_SP];
+
+    if (profiler->has_last) {
+        if (!profiler->last_charged) charge(profiler, cycles - profiler->last_cycles);
+        track_calls(profiler, memory, address, sp);
+    }
+    if (profiler->pending_interrupt) {
+        push_frame(profiler, INTERRUPT_TARGET + address, sp);
+        profiler->pending_interrupt = 0;
+    }
+
+    profiler->counts[address]++;
+    profiler->has_last = 1;
+    profiler->last_charged = 0;
+    profiler->last_pc = address;
+    profiler->last_cycles = cycles;
+}
+
+void profiler_step_end(Profiler* profiler, int elapsed) {
+    // The call stack effect of the last instruction is only known once the
+    // next one starts
+    if (!profiler->has_last || profiler->last_charged) return;
+    charge(profiler, elapsed - profiler->last_cycles);
+    profiler->last_charged = 1;
+}
+
+void profiler_interrupt(Profiler* profiler) {
+    // Cycles of an IM 0 bus instruction aren't counted by the emulation loop
+    profiler->last_charged = 1;
+    profiler->pending_interrupt = 1;
+}
+
+void profiler_frame(Profiler* profiler) {
+    profiler->frame_cycles.push_back(profiler->current_frame_cycles);
+    profiler->current_frame_cycles = 0;
+}
+
+//
+// Reports
+//
+
+int profiler_write_report(const Profiler* profiler, const char* path, const char* title, uint64_t frame_tstates) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        printf("Can't create profile '%s'\n", path);
+        return -1;
+    }
+
+    uint64_t instructions = 0;
+    uint64_t executed = 0;
+    std::vector<int> addresses;
+    for (int pc = 0; pc < 0x10000; pc++) {
+        instructions += profiler->counts[pc];
+        executed += profiler->cycles[pc];
+        if (profiler->counts[pc]) addresses.push_back(pc);
+    }
+    std::sort(addresses.begin(), addresses.end(), [profiler](int a, int b) {
+        if (profiler->cycles[a] != profiler->cycles[b]) return profiler->cycles[a] > profiler->cycles[b];
+        return a < b;
+    });
+
+    const std::vector<uint32_t>& frames = profiler->frame_cycles;
+    uint64_t frame_total = 0;
+    size_t worst = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+        frame_total += frames[i];
+        if (frames[i] > frames[worst]) worst = i;
+    }
+
+    fprintf(out, "Profile of %s\n", title);
+    fprintf(out, "%llu instructions, %llu cycles executed, %zu frames\n",
+        (unsigned long long)instructions, (unsigned long long)executed, frames.size());
+    if (!frames.empty()) {
+        fprintf(out, "Cycles executed per frame: average %.0f, worst %u (frame %zu, %.1f%% of the frame)\n",
+            (double)frame_total / frames.size(), frames[worst], worst,
+            frame_tstates ? 100.0 * frames[worst] / frame_tstates : 0.0);
+    }
+
+    fprintf(out, "\n  address       cycles      %%    instructions  cycles/instr\n");
+    for (size_t i = 0; i < addresses.size() && i < PROFILE_TOP_ADDRESSES; i++) {
+        int pc = addresses[i];
+        fprintf(out, "  0x%04X  %12llu  %5.1f  %14llu  %12.1f\n", pc,
+            (unsigned long long)profiler->cycles[pc], executed ? 100.0 * profiler->cycles[pc] / executed : 0.0,
+            (unsigned long long)profiler->counts[pc], (double)profiler->cycles[pc] / profiler->counts[pc]);
+    }
+
+    fprintf(out, "\nFrame  cycles\n");
+    for (size_t i = 0; i < frames.size(); i++) fprintf(out, "%5zu  %u\n", i, frames[i]);
+
+    int failed = ferror(out) != 0;
+    if (fclose(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+static void node_name(const ProfileNode& node, char* out, size_t size) {
+    if (node.target >= INTERRUPT_TARGET) snprintf(out, size, "int_0x%04X", node.target - INTERRUPT_TARGET);
+    else snprintf(out, size, "0x%04X", node.target);
+}
+
+int profiler_write_folded(const Profiler* profiler, const char* path, const char* root) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        printf("Can't create profile '%s'\n", path);
+        return -1;
+    }
+
+    // One line per call path: root;caller;...;callee cycles
+    std::string safe_root(root);
+    std::replace(safe_root.begin(), safe_root.end(), ';', '_');
+    std::replace(safe_root.begin(), safe_root.end(), ' ', '_');
+    for (size_t i = 0; i < profiler->nodes.size(); i++) {
+        if (profiler->nodes[i].cycles == 0) continue;
+        std::vector<std::string> names;
+        for (int n = (int)i; n > 0; n = profiler->nodes[n].parent) {
+            char name[32];
+            node_name(profiler->nodes[n], name, sizeof(name));
+            names.push_back(name);
+        }
+        fputs(safe_root.c_str(), out);
+        for (size_t k = names.size(); k-- > 0;) fprintf(out, ";%s", names[k].c_str());
+        fprintf(out, " %llu\n", (unsigned long long)profiler->nodes[i].cycles);
+    }
+
+    int failed = ferror(out) != 0;
+    if (fclose(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,90 @@
+/* profile.h
+ * Z80 hot-spot profiler for player routines (--profile, builds with
+ * AY2YM_PROFILE defined only).
+ *
+ * The per-instruction hook in z80emu counts every instruction and charges
+ * it the cycles up to the next one, per address and per call stack. Stacks
+ * are followed from taken CALL/RST/RET instructions and accepted
+ * interrupts; a RET drops every frame whose entry SP is below the new SP,
+ * so players that juggle their stack don't leave stale frames behind.
+ * Cycles spent halted aren't charged to anything.
+ *
+ * Without AY2YM_PROFILE the hook does not call into the profiler at all.
+ */
+
+#ifndef __PROFILE_INCLUDED__
+#define __PROFILE_INCLUDED__
+
+#include "z80emu.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define PROFILE_MAX_DEPTH 64
+#define PROFILE_TOP_ADDRESSES 50
+
+typedef struct ProfileFrame {
+    int node;                 // call tree node entered
+    uint16_t entry_sp;        // SP right after the return address was pushed
+} ProfileFrame;
+
+typedef struct ProfileNode {
+    int parent;
+    int target;               // called address, +0x10000 for interrupts
+    uint64_t cycles;          // exclusive
+} ProfileNode;
+
+typedef struct Profiler {
+    uint64_t counts[0x10000];
+    uint64_t cycles[0x10000];
+
+    std::vector<ProfileNode> nodes;                   // node 0 is the song itself
+    std::unordered_map<uint64_t, int> node_index;     // (parent, target) -> node
+    ProfileFrame stack[PROFILE_MAX_DEPTH];
+    int depth;
+
+    int has_last;             // last_pc is waiting for its call stack effect
+    int last_charged;         // ... and already has its cycles
+    int last_pc;
+    int last_cycles;
+    int pending_interrupt;    // next instruction is an interrupt entry
+
+    std::vector<uint32_t> frame_cycles;   // cycles executed in each frame
+    uint32_t current_frame_cycles;
+} Profiler;
+
+// Returns NULL on allocation failure
+Profiler* profiler_create();
+void profiler_destroy(Profiler* profiler);
+
+// After each Z80Emulate() call, with the cycles it returned
+void profiler_step_end(Profiler* profiler, int elapsed);
+
+// After an interrupt was accepted
+void profiler_interrupt(Profiler* profiler);
+
+// At each frame boundary
+void profiler_frame(Profiler* profiler);
+
+// Sorted text report and folded stacks (flamegraph.pl input). Return 0 on
+// success, -1 on failure.
+int profiler_write_report(const Profiler* profiler, const char* path, const char* title, uint64_t frame_tstates);
+int profiler_write_folded(const Profiler* profiler, const char* path, const char* root);
+
+extern "C" {
+#endif
+
+struct Profiler;
+
+// Called by the instruction hook
+void profiler_instruction(struct Profiler* profiler, const Z80_STATE* state, const uint8_t* memory,
+    int address, int cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
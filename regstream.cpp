@@ -0,0 +1,254 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "regstream.h"
+#include "logging.h"
+#include <string.h>
+
+static void pack_uint32_le(uint32_t value, unsigned char* out) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+static int put_bytes(RegisterStream* rs, const void* data, size_t length) {
+    return fwrite(data, 1, length, rs->file) == length ? 0 : -1;
+}
+
+// VGM samples from the start of the stream to the end of frame tick 'frames'.
+// Rounding down from there keeps a frame that isn't a whole number of samples
+// long from drifting.
+static uint64_t vgm_samples_at(const RegisterStream* rs, uint64_t frames) {
+    return frames * VGM_SAMPLE_RATE * rs->frame_tstates / rs->cpu_clock;
+}
+
+// Write 'count' frame ticks in the format's own wait encoding
+static int flush_pending_frames(RegisterStream* rs) {
+    uint32_t count = rs->pending_frames;
+    rs->pending_frames = 0;
+
+    if (rs->format == STREAM_VGM) {
+        // Every tick of the stream has been counted in frames, the pending
+        // ones are the last
+        uint64_t start = rs->frames - count;
+
+        // 0x63 waits exactly 1/50s, anything else uses 0x61 nnnn (max 65535 samples)
+        if (count == 1 && vgm_samples_at(rs, start + 1) - vgm_samples_at(rs, start) == 882) {
+            unsigned char cmd = 0x63;
+            return put_bytes(rs, &cmd, 1);
+        }
+        uint32_t max_frames = 65535 / rs->samples_per_frame;
+        while (count > 0) {
+            uint32_t n = count > max_frames ? max_frames : count;
+            uint32_t samples = (uint32_t)(vgm_samples_at(rs, start + n) - vgm_samples_at(rs, start));
+            start += n;
+            unsigned char cmd[3] = { 0x61, (unsigned char)(samples & 0xFF), (unsigned char)(samples >> 8) };
+            if (put_bytes(rs, cmd, 3)) return -1;
+            count -= n;
+        }
+    }
+    else {
+        // 0xFE n skips n*4 interrupts, 0xFF is a single interrupt
+        while (count >= 4) {
+            uint32_t n = count / 4 > 255 ? 255 : count / 4;
+            unsigned char cmd[2] = { 0xFE, (unsigned char)n };
+            if (put_bytes(rs, cmd, 2)) return -1;
+            count -= n * 4;
+        }
+        while (count > 0) {
+            unsigned char cmd = 0xFF;
+            if (put_bytes(rs, &cmd, 1)) return -1;
+            count--;
+        }
+    }
+    return 0;
+}
+
+// Emit the register writes that turn last_regs into regs, followed by one frame tick
+static int emit_frame(RegisterStream* rs, const uint8_t* regs, int env_written) {
+    if (rs->format == STREAM_PSG) {
+        // PSG: interrupt marker comes before the writes of the frame
+        rs->pending_frames++;
+    }
+
+    for (int reg = 0; reg < STREAM_REG_COUNT; reg++) {
+        if (regs[reg] == rs->last_regs[reg] && !(reg == 13 && env_written))
+            continue;
+
+        if (rs->pending_frames && flush_pending_frames(rs)) return -1;
+
+        if (rs->format == STREAM_VGM) {
+            unsigned char cmd[3] = { 0xA0, (unsigned char)reg, regs[reg] };
+            if (put_bytes(rs, cmd, 3)) return -1;
+        }
+        else {
+            unsigned char cmd[2] = { (unsigned char)reg, regs[reg] };
+            if (put_bytes(rs, cmd, 2)) return -1;
+        }
+        rs->last_regs[reg] = regs[reg];
+    }
+
+    if (rs->format == STREAM_VGM) {
+        // VGM: wait comes after the writes of the frame
+        rs->pending_frames++;
+        rs->total_samples = vgm_samples_at(rs, rs->frames + 1);
+    }
+    rs->frames++;
+    return 0;
+}
+
+int regstream_open(RegisterStream* rs, StreamFormat format, const char* path, uint32_t ay_clock,
+    uint32_t frame_rate, uint32_t cpu_clock, uint32_t frame_tstates, const char* title, const char* author)
+{
+    memset(rs, 0, sizeof(*rs));
+    rs->format = format;
+    rs->frame_rate = frame_rate;
+    rs->cpu_clock = cpu_clock;
+    rs->frame_tstates = frame_tstates;
+    rs->samples_per_frame = (uint32_t)(((uint64_t)VGM_SAMPLE_RATE * frame_tstates + cpu_clock - 1) / cpu_clock);
+    rs->title = title ? title : "";
+    rs->author = author ? author : "";
+
+    rs->file = fopen(path, "wb");
+    if (!rs->file) {
+        printf("Can't open output file '%s'\n", path);
+        return -1;
+    }
+
+    if (format == STREAM_VGM) {
+        // VGM 1.51 header, sizes and sample count are patched on close
+        unsigned char header[VGM_HEADER_SIZE];
+        memset(header, 0, sizeof(header));
+        memcpy(header, "Vgm ", 4);
+        pack_uint32_le(0x00000151, header + 0x08);
+        pack_uint32_le(frame_rate, header + 0x24);
+        pack_uint32_le(VGM_HEADER_SIZE - 0x34, header + 0x34);
+        pack_uint32_le(ay_clock, header + 0x74);
+        header[0x78] = 0x00;    // AY8910
+        header[0x79] = 0x01;    // legacy output
+        return put_bytes(rs, header, sizeof(header));
+    }
+
+    unsigned char header[PSG_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, "PSG\x1A", 4);
+    return put_bytes(rs, header, sizeof(header));
+}
+
+int regstream_frame(RegisterStream* rs, const uint8_t regs[16], int env_written) {
+    int all_zero = 1;
+    for (int reg = 0; reg < 16; reg++) {
+        if (regs[reg] != 0) {
+            all_zero = 0;
+            break;
+        }
+    }
+
+    // Hold back runs of silent frames, they are only written once something
+    // follows them
+    if (all_zero) {
+        rs->pending_zero_frames++;
+        return 0;
+    }
+
+    if (rs->pending_zero_frames) {
+        static const uint8_t zero_regs[STREAM_REG_COUNT] = { 0 };
+        uint32_t run = rs->pending_zero_frames;
+        rs->pending_zero_frames = 0;
+        for (uint32_t i = 0; i < run; i++) {
+            if (emit_frame(rs, zero_regs, 0)) return -1;
+        }
+    }
+
+    return emit_frame(rs, regs, env_written);
+}
+
+// GD3 strings are UTF-16LE, AY strings are treated as Latin-1
+static int put_gd3_string(RegisterStream* rs, const char* s, uint32_t* length) {
+    for (; *s; s++) {
+        unsigned char wc[2] = { (unsigned char)*s, 0 };
+        if (put_bytes(rs, wc, 2)) return -1;
+        *length += 2;
+    }
+    unsigned char nul[2] = { 0, 0 };
+    *length += 2;
+    return put_bytes(rs, nul, 2);
+}
+
+static int write_gd3(RegisterStream* rs) {
+    const char* comment = "Converted by Negative Charge(@negativecharge.bsky.social)";
+    const char* strings[11] = {
+        rs->title, "",      // track name
+        "", "",             // game name
+        "", "",             // system name
+        rs->author, "",     // author
+        "",                 // release date
+        "",                 // converted by
+        comment             // notes
+    };
+
+    long start = ftell(rs->file);
+    unsigned char header[12];
+    memcpy(header, "Gd3 ", 4);
+    pack_uint32_le(0x00000100, header + 4);
+    pack_uint32_le(0, header + 8);
+    if (put_bytes(rs, header, sizeof(header))) return -1;
+
+    uint32_t length = 0;
+    for (int i = 0; i < 11; i++) {
+        if (put_gd3_string(rs, strings[i], &length)) return -1;
+    }
+
+    // Patch GD3 data length
+    unsigned char packed[4];
+    pack_uint32_le(length, packed);
+    fseek(rs->file, start + 8, SEEK_SET);
+    if (put_bytes(rs, packed, 4)) return -1;
+    fseek(rs->file, 0, SEEK_END);
+    return 0;
+}
+
+uint32_t regstream_close(RegisterStream* rs) {
+    if (!rs->file) return 0;
+
+    // Trailing silence is dropped
+    if (rs->pending_zero_frames) {
+        log_printf("Trimmed %u trailing zero frames from output.\n", rs->pending_zero_frames);
+        rs->pending_zero_frames = 0;
+    }
+
+    int failed = flush_pending_frames(rs);
+
+    if (rs->format == STREAM_VGM) {
+        unsigned char end = 0x66;
+        failed |= put_bytes(rs, &end, 1);
+
+        long gd3_offset = ftell(rs->file);
+        failed |= write_gd3(rs);
+        long eof_offset = ftell(rs->file);
+
+        unsigned char packed[4];
+        pack_uint32_le((uint32_t)(eof_offset - 0x04), packed);
+        fseek(rs->file, 0x04, SEEK_SET);
+        failed |= put_bytes(rs, packed, 4);
+
+        pack_uint32_le((uint32_t)(gd3_offset - 0x14), packed);
+        fseek(rs->file, 0x14, SEEK_SET);
+        failed |= put_bytes(rs, packed, 4);
+
+        pack_uint32_le((uint32_t)rs->total_samples, packed);
+        failed |= put_bytes(rs, packed, 4);
+    }
+    else {
+        unsigned char end = 0xFD;
+        failed |= put_bytes(rs, &end, 1);
+    }
+
+    if (fclose(rs->file) != 0) failed = -1;
+    rs->file = NULL;
+
+    if (failed) {
+        printf("Warning: write error while finishing register stream\n");
+    }
+    return rs->frames;
+}
@@ -0,0 +1,57 @@
+/* regstream.h
+ * Changes-only AY register stream writers (VGM, PSG).
+ *
+ * Unlike YM6, these formats only store the registers that changed in each
+ * frame, so they can be written to disk while the emulation is running.
+ */
+
+#ifndef __REGSTREAM_INCLUDED__
+#define __REGSTREAM_INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define VGM_SAMPLE_RATE 44100
+#define VGM_HEADER_SIZE 0x80
+#define PSG_HEADER_SIZE 16
+
+// Only the sound registers are streamed, the I/O ports (R14/R15) are not
+#define STREAM_REG_COUNT 14
+
+typedef enum {
+    STREAM_VGM = 0,
+    STREAM_PSG
+} StreamFormat;
+
+typedef struct RegisterStream {
+    StreamFormat format;
+    FILE* file;
+    uint8_t last_regs[STREAM_REG_COUNT];  // chip state as seen by the player
+    uint32_t frame_rate;
+    uint32_t cpu_clock;                   // VGM only: the frame period, for exact waits
+    uint32_t frame_tstates;
+    uint32_t samples_per_frame;           // VGM only, rounded up
+    uint32_t pending_frames;              // frame ticks not written yet
+    uint32_t pending_zero_frames;         // run of all-zero frames (trimmed if trailing)
+    uint32_t frames;                      // frames kept in the output
+    uint64_t total_samples;               // VGM only
+    const char* title;
+    const char* author;
+} RegisterStream;
+
+// frame_rate goes in the VGM header, the waits follow the exact frame period
+// of frame_tstates CPU cycles at cpu_clock. Returns 0 on success, -1 if the
+// output file can't be created.
+int regstream_open(RegisterStream* rs, StreamFormat format, const char* path, uint32_t ay_clock,
+    uint32_t frame_rate, uint32_t cpu_clock, uint32_t frame_tstates, const char* title, const char* author);
+
+// Feed one frame of AY registers. env_written is non-zero if R13 was written
+// during the frame, which restarts the envelope even if the value is the same.
+// Returns 0 on success, -1 on write error.
+int regstream_frame(RegisterStream* rs, const uint8_t regs[16], int env_written);
+
+// Finish the stream and close the file. Trailing all-zero frames are dropped,
+// like the YM6 writer does. Returns the number of frames kept.
+uint32_t regstream_close(RegisterStream* rs);
+
+#endif
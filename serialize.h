@@ -0,0 +1,55 @@
+/* serialize.h
+ * Writers shared by the index, pack and stats formats: little endian
+ * integers and length-prefixed strings appended to a byte buffer, and JSON
+ * string literals.
+ */
+
+#ifndef __SERIALIZE_INCLUDED__
+#define __SERIALIZE_INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static inline void put_u8(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back((uint8_t)value);
+}
+
+static inline void put_u16(std::vector<uint8_t>& out, uint32_t value) {
+    put_u8(out, value);
+    put_u8(out, value >> 8);
+}
+
+static inline void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+    put_u16(out, value);
+    put_u16(out, value >> 16);
+}
+
+static inline void put_u64(std::vector<uint8_t>& out, uint64_t value) {
+    put_u32(out, (uint32_t)value);
+    put_u32(out, (uint32_t)(value >> 32));
+}
+
+// 16-bit length, then the bytes; longer strings are cut at 65535 bytes
+static inline void put_string(std::vector<uint8_t>& out, const std::string& text) {
+    size_t length = std::min(text.size(), (size_t)0xFFFF);
+    put_u16(out, (uint32_t)length);
+    out.insert(out.end(), text.begin(), text.begin() + length);
+}
+
+// AY strings have no defined encoding; bytes above 0x7F are kept as the
+// matching Latin-1 code points so the output is always valid JSON
+static inline void json_string(FILE* out, const std::string& text) {
+    fputc('"', out);
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20 || c >= 0x7F) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+#endif
@@ -0,0 +1,798 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "sinks.h"
+#include "lha.h"
+#include "logging.h"
+#include "regstream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+static const char* const format_names[OUTPUT_FORMAT_COUNT] = { "ym", "lha", "vgm", "psg", "regs", "wav", "pcm" };
+static const char* const format_extensions[OUTPUT_FORMAT_COUNT] = { "ym", "ym", "vgm", "psg", "regs", "wav", "pcm" };
+
+const char* output_format_name(OutputFormat format) {
+    return format_names[format];
+}
+
+const char* output_format_extension(OutputFormat format) {
+    return format_extensions[format];
+}
+
+int output_format_from_name(const char* name, OutputFormat* format) {
+    for (int i = 0; i < OUTPUT_FORMAT_COUNT; i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            *format = (OutputFormat)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void pack_uint32_be(uint32_t value, unsigned char* out) {
+    out[0] = (value >> 24) & 0xFF;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+static void pack_uint16_be(uint16_t value, unsigned char* out) {
+    out[0] = (value >> 8) & 0xFF;
+    out[1] = value & 0xFF;
+}
+
+static void pack_uint32_le(uint32_t value, unsigned char* out) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+static void pack_uint16_le(uint16_t value, unsigned char* out) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+}
+
+static int is_zero_frame(const uint8_t* regs) {
+    for (int reg = 0; reg < 16; reg++) {
+        if (regs[reg] != 0) return 0;
+    }
+    return 1;
+}
+
+//
+// YM6 (optionally LHA packed): frames are buffered, the file is written on finish
+//
+
+typedef struct YmSink {
+    Arena* arena;
+    FILE* file;
+    const char* path;
+    SongInfo info;
+    int compress;
+    unsigned char* tone_data;
+    size_t tone_size;
+    size_t tone_capacity;
+    int frame_number;
+} YmSink;
+
+static int ym_frame(void* state, const FrameRecord* record) {
+    YmSink* ym = (YmSink*)state;
+
+    if (ym->tone_size + 16 > ym->tone_capacity) {
+        // The tone data is the sink's last allocation, so this grows in place
+        unsigned char* new_tone_data = (unsigned char*)arena_grow(ym->arena, ym->tone_data,
+            ym->tone_capacity, ym->tone_capacity * 2);
+        if (!new_tone_data) {
+            return -1;
+        }
+        ym->tone_data = new_tone_data;
+        ym->tone_capacity *= 2;
+    }
+
+    memcpy(ym->tone_data + ym->tone_size, record->regs, 16);
+    ym->tone_size += 16;
+    ym->frame_number++;
+    return 0;
+}
+
+static uint32_t ym_finish(void* state) {
+    YmSink* ym = (YmSink*)state;
+    int frame_number = ym->frame_number;
+    unsigned char* tone_data = ym->tone_data;
+
+    // If no frames were generated, the file gets deleted
+    if (frame_number == 0) {
+        log_printf("No frames generated during emulation; deleting output file.\n");
+        fclose(ym->file);
+        ym->file = NULL;
+        return 0;
+    }
+
+    // Trim trailing zero frames
+    int zero_frame_count = 0;
+    for (int i = frame_number - 1; i >= 0; i--) {
+        if (is_zero_frame(tone_data + i * 16)) zero_frame_count++;
+        else break;
+    }
+
+    if (zero_frame_count > 0) {
+        frame_number -= zero_frame_count;
+        log_printf("Trimmed %d trailing zero frames from output.\n", zero_frame_count);
+    }
+    else {
+        log_printf("No trailing zero frames to trim.\n");
+    }
+
+    // If no frames remain after trimming, the file gets deleted
+    if (frame_number == 0) {
+        log_printf("No non-zero frames remain after trimming; deleting output file.\n");
+        fclose(ym->file);
+        ym->file = NULL;
+        return 0;
+    }
+
+    // Everything is known by now, so the file is built in one buffer of the
+    // exact size
+    const char* comment = "Converted by Negative Charge(@negativecharge.bsky.social)";
+    size_t title_size = strlen(ym->info.title) + 1;
+    size_t author_size = strlen(ym->info.author) + 1;
+    size_t comment_size = strlen(comment) + 1;
+    size_t ym_size = 34 + title_size + author_size + comment_size + (size_t)frame_number * 16 + 4;
+    unsigned char* ym_data = (unsigned char*)arena_alloc(ym->arena, ym_size);
+    if (!ym_data) {
+        fclose(ym->file);
+        ym->file = NULL;
+        return 0;
+    }
+    unsigned char* out = ym_data;
+
+    // Write YM6 file ID and check string
+    memcpy(out, "YM6!LeOnArD!", 12);
+    out += 12;
+
+    // Number of frames
+    pack_uint32_be(frame_number, out);
+    out += 4;
+
+    // Song attributes: 0x09 (interleaved | AY-compatible)
+    pack_uint32_be(0x09, out);
+    out += 4;
+
+    // Number of digidrums
+    pack_uint16_be(0, out);
+    out += 2;
+
+    // Master clock
+    pack_uint32_be(ym->info.ay_clock, out);
+    out += 4;
+
+    // Player frequency
+    pack_uint16_be((uint16_t)ym->info.frame_rate, out);
+    out += 2;
+
+    // VBL loop position
+    pack_uint32_be(0, out);
+    out += 4;
+
+    // Additional data size
+    pack_uint16_be(0, out);
+    out += 2;
+
+    // Song name, author, comment (each NUL terminated)
+    memcpy(out, ym->info.title, title_size);
+    out += title_size;
+    memcpy(out, ym->info.author, author_size);
+    out += author_size;
+    memcpy(out, comment, comment_size);
+    out += comment_size;
+
+    // Interleave tone data, then the terminator
+    for (int reg = 0; reg < 16; reg++) {
+        for (int f = 0; f < frame_number; f++) {
+            out[reg * frame_number + f] = tone_data[f * 16 + reg];
+        }
+    }
+    out += (size_t)frame_number * 16;
+    memcpy(out, "End!", 4);
+
+    // Write file
+    unsigned char* archive = NULL;
+    if (ym->compress) {
+        // The archive member is named after the output file
+        const char* name = ym->path;
+        const char* slash1 = strrchr(name, '/');
+        const char* slash2 = strrchr(name, '\\');
+        const char* slash = slash1 > slash2 ? slash1 : slash2;
+        if (slash) name = slash + 1;
+
+        size_t archive_size = 0;
+        if (lha_pack(ym_data, ym_size, name, &archive, &archive_size) != 0) {
+            printf("Failed to compress '%s'\n", ym->path);
+            fclose(ym->file);
+            ym->file = NULL;
+            return 0;
+        }
+        log_printf("Compressed YM data from %zu to %zu bytes.\n", ym_size, archive_size);
+        ym_data = archive;
+        ym_size = archive_size;
+    }
+
+    size_t written = fwrite(ym_data, 1, ym_size, ym->file);
+    int closed = fclose(ym->file);
+    ym->file = NULL;
+    free(archive);
+
+    if (written != ym_size || closed != 0) {
+        printf("Failed to write output file '%s'\n", ym->path);
+        return 0;
+    }
+    return (uint32_t)frame_number;
+}
+
+static void ym_release(void* state) {
+    YmSink* ym = (YmSink*)state;
+    if (ym->file) fclose(ym->file);
+}
+
+static void* ym_open(const char* path, const SongInfo* info, int compress, Arena* arena) {
+    YmSink* ym = (YmSink*)arena_alloc(arena, sizeof(YmSink));
+    if (!ym) return NULL;
+    memset(ym, 0, sizeof(*ym));
+
+    ym->arena = arena;
+    ym->path = path;
+    ym->info = *info;
+    ym->compress = compress;
+    // The song length bounds the frame count, so the buffer normally never grows
+    ym->tone_capacity = info->frame_budget ? (size_t)info->frame_budget * 16 : 1024;
+    ym->tone_data = (unsigned char*)arena_alloc(arena, ym->tone_capacity);
+    ym->file = fopen(path, "wb");
+    if (!ym->file || !ym->tone_data) {
+        printf("Can't open output file '%s'\n", path);
+        ym_release(ym);
+        return NULL;
+    }
+    return ym;
+}
+
+//
+// VGM and PSG: written as the frames arrive
+//
+
+static int stream_frame(void* state, const FrameRecord* record) {
+    return regstream_frame((RegisterStream*)state, record->regs, record->env_written);
+}
+
+static uint32_t stream_finish(void* state) {
+    return regstream_close((RegisterStream*)state);
+}
+
+static void stream_release(void* state) {
+    RegisterStream* rs = (RegisterStream*)state;
+    if (rs->file) fclose(rs->file);
+}
+
+static void* stream_open(const char* path, const SongInfo* info, StreamFormat format, Arena* arena) {
+    RegisterStream* rs = (RegisterStream*)arena_alloc(arena, sizeof(RegisterStream));
+    if (!rs) return NULL;
+    if (regstream_open(rs, format, path, info->ay_clock, info->frame_rate,
+        info->cpu_clock, info->frame_tstates, info->title, info->author) != 0) {
+        stream_release(rs);
+        return NULL;
+    }
+    return rs;
+}
+
+//
+// Raw register dump: 16 bytes per frame, trailing silence trimmed
+//
+
+typedef struct RegsSink {
+    FILE* file;
+    uint32_t frames;
+    uint32_t pending_zero_frames;
+    int failed;
+} RegsSink;
+
+static int regs_frame(void* state, const FrameRecord* record) {
+    RegsSink* rs = (RegsSink*)state;
+
+    if (is_zero_frame(record->regs)) {
+        rs->pending_zero_frames++;
+        return 0;
+    }
+
+    static const uint8_t zero_regs[16] = { 0 };
+    for (; rs->pending_zero_frames > 0; rs->pending_zero_frames--) {
+        if (fwrite(zero_regs, 1, 16, rs->file) != 16) return -1;
+        rs->frames++;
+    }
+    if (fwrite(record->regs, 1, 16, rs->file) != 16) return -1;
+    rs->frames++;
+    return 0;
+}
+
+static uint32_t regs_finish(void* state) {
+    RegsSink* rs = (RegsSink*)state;
+    if (rs->pending_zero_frames) {
+        log_printf("Trimmed %u trailing zero frames from output.\n", rs->pending_zero_frames);
+    }
+    int closed = fclose(rs->file);
+    rs->file = NULL;
+    return closed == 0 ? rs->frames : 0;
+}
+
+static void regs_release(void* state) {
+    RegsSink* rs = (RegsSink*)state;
+    if (rs->file) fclose(rs->file);
+}
+
+static void* regs_open(const char* path, Arena* arena) {
+    RegsSink* rs = (RegsSink*)arena_alloc(arena, sizeof(RegsSink));
+    if (!rs) return NULL;
+    memset(rs, 0, sizeof(*rs));
+    rs->file = fopen(path, "wb");
+    if (!rs->file) {
+        printf("Can't open output file '%s'\n", path);
+        return NULL;
+    }
+    return rs;
+}
+
+//
+// Threads kept from song to song. Each emulation worker has its own sink
+// threads and each sink thread its own audio render threads, started by
+// the first song that needs them and parked between songs.
+//
+
+typedef struct TaskThread {
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable changed;
+    void (*task)(void* arg);
+    void* arg;
+    int quit;
+
+    TaskThread() : task(NULL), arg(NULL), quit(0) {}
+    ~TaskThread() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            quit = 1;
+            changed.notify_all();
+        }
+        thread.join();
+    }
+} TaskThread;
+
+static void task_thread_main(TaskThread* t) {
+    std::unique_lock<std::mutex> guard(t->lock);
+    for (;;) {
+        t->changed.wait(guard, [&] { return t->task || t->quit; });
+        if (!t->task) return;
+        guard.unlock();
+        t->task(t->arg);
+        guard.lock();
+        t->task = NULL;
+        t->changed.notify_all();
+    }
+}
+
+// Run task(arg) on the thread, starting it if this is its first task
+static void task_start(TaskThread* t, void (*task)(void* arg), void* arg) {
+    if (!t->thread.joinable()) t->thread = std::thread(task_thread_main, t);
+    std::lock_guard<std::mutex> guard(t->lock);
+    t->task = task;
+    t->arg = arg;
+    t->changed.notify_all();
+}
+
+static void task_wait(TaskThread* t) {
+    std::unique_lock<std::mutex> guard(t->lock);
+    t->changed.wait(guard, [&] { return t->task == NULL; });
+}
+
+//
+// Audio (WAV or raw). Frames are kept while the song is emulated, and a
+// state-only synth pass records a checkpoint at every segment boundary.
+// On finish the segments are rendered on all cores and written in order;
+// the rendered samples belong to the render threads and come from the heap.
+//
+
+#define PCM_SEGMENT_FRAMES 1500      // 30 seconds at 50 Hz
+
+typedef struct PcmSegment {
+    int16_t* samples;
+    size_t bytes;
+    int done;
+} PcmSegment;
+
+typedef struct PcmSink {
+    Arena* arena;
+    FILE* file;
+    int wav;
+    SongInfo info;
+    AySynth synth;                  // first pass, state only
+    FrameRecord* frames;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    AySynthState* checkpoints;      // state entering the frame before each segment
+    uint32_t checkpoint_count;
+    uint32_t checkpoint_capacity;
+    uint64_t data_bytes;
+
+    // Rendering
+    PcmSegment* segments;
+    uint32_t segment_count;
+    uint32_t frames_kept;
+    std::atomic<uint32_t> next_segment;
+    uint32_t lookahead;             // segments a render thread may run ahead of the writer
+    uint32_t segments_written;
+    int aborted;
+    std::mutex lock;
+    std::condition_variable changed;
+} PcmSink;
+
+static int write_wav_header(PcmSink* ps) {
+    unsigned char header[44];
+    uint32_t data_bytes = ps->data_bytes > 0xFFFFFFD3ULL ? 0xFFFFFFD3U : (uint32_t)ps->data_bytes;
+    uint16_t channels = (uint16_t)ps->synth.channels;
+
+    memcpy(header, "RIFF", 4);
+    pack_uint32_le(36 + data_bytes, header + 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    pack_uint32_le(16, header + 16);
+    pack_uint16_le(1, header + 20);                 // PCM
+    pack_uint16_le(channels, header + 22);
+    pack_uint32_le(ps->synth.sample_rate, header + 24);
+    pack_uint32_le(ps->synth.sample_rate * channels * 2, header + 28);
+    pack_uint16_le(channels * 2, header + 32);
+    pack_uint16_le(16, header + 34);
+    memcpy(header + 36, "data", 4);
+    pack_uint32_le(data_bytes, header + 40);
+
+    return fwrite(header, 1, sizeof(header), ps->file) == sizeof(header) ? 0 : -1;
+}
+
+static int pcm_frame(void* state, const FrameRecord* record) {
+    PcmSink* ps = (PcmSink*)state;
+
+    if (ps->frame_count == ps->frame_capacity) {
+        uint32_t capacity = ps->frame_capacity * 2;
+        FrameRecord* frames = (FrameRecord*)arena_grow(ps->arena, ps->frames,
+            ps->frame_capacity * sizeof(FrameRecord), capacity * sizeof(FrameRecord));
+        if (!frames) return -1;
+        ps->frames = frames;
+        ps->frame_capacity = capacity;
+    }
+
+    // A segment starting at frame s is rendered from the state entering
+    // frame s - 1, which is rendered once and thrown away to settle the synth
+    if ((ps->frame_count + 1) % PCM_SEGMENT_FRAMES == 0 || ps->frame_count == 0) {
+        if (ps->checkpoint_count == ps->checkpoint_capacity) {
+            uint32_t capacity = ps->checkpoint_capacity * 2;
+            AySynthState* checkpoints = (AySynthState*)arena_grow(ps->arena, ps->checkpoints,
+                ps->checkpoint_capacity * sizeof(AySynthState), capacity * sizeof(AySynthState));
+            if (!checkpoints) return -1;
+            ps->checkpoints = checkpoints;
+            ps->checkpoint_capacity = capacity;
+        }
+        ps->checkpoints[ps->checkpoint_count++] = ps->synth.state;
+    }
+
+    ps->frames[ps->frame_count++] = *record;
+    aysynth_advance_frame(&ps->synth, record->regs, record->env_written);
+    return 0;
+}
+
+static int pcm_render_segment(PcmSink* ps, AySynth* synth, uint32_t index) {
+    PcmSegment* seg = &ps->segments[index];
+    uint32_t first = index * PCM_SEGMENT_FRAMES;
+    uint32_t last = first + PCM_SEGMENT_FRAMES;
+    if (last > ps->frames_kept) last = ps->frames_kept;
+
+    size_t frame_samples = (size_t)synth->samples_per_frame * synth->channels;
+    seg->samples = (int16_t*)malloc((last - first) * frame_samples * sizeof(int16_t));
+    if (!seg->samples) return -1;
+
+    aysynth_restore(synth, &ps->checkpoints[index]);
+    uint32_t frame = first;
+    if (index > 0) {
+        frame = first - 1;
+        aysynth_render_frame(synth, ps->frames[frame].regs, ps->frames[frame].env_written, seg->samples);
+        frame++;
+    }
+    int16_t* out = seg->samples;
+    for (; frame < last; frame++) {
+        out += aysynth_render_frame(synth, ps->frames[frame].regs, ps->frames[frame].env_written, out) * synth->channels;
+    }
+    seg->bytes = (out - seg->samples) * sizeof(int16_t);
+    return 0;
+}
+
+// Workers take segments in order but stay within a few segments of the
+// writer, so only a bounded part of the song is held as samples
+static void pcm_worker(void* arg) {
+    PcmSink* ps = (PcmSink*)arg;
+    const uint32_t lookahead = ps->lookahead;
+    AySynth synth;
+    int ok = aysynth_init(&synth, ps->info.ay_clock, ps->info.cpu_clock, ps->info.frame_tstates, &ps->info.pcm) == 0;
+
+    for (;;) {
+        uint32_t index = ps->next_segment.fetch_add(1);
+        if (index >= ps->segment_count) break;
+        {
+            std::unique_lock<std::mutex> guard(ps->lock);
+            ps->changed.wait(guard, [&] { return ps->aborted || index < ps->segments_written + lookahead; });
+            if (ps->aborted) break;
+        }
+
+        int failed = !ok || pcm_render_segment(ps, &synth, index) != 0;
+
+        std::lock_guard<std::mutex> guard(ps->lock);
+        ps->segments[index].done = 1;
+        if (failed) ps->aborted = 1;
+        ps->changed.notify_all();
+    }
+
+    if (ok) aysynth_free(&synth);
+}
+
+static int pcm_write_segments(PcmSink* ps) {
+    // The render threads of the sink thread this runs on
+    static thread_local std::unique_ptr<TaskThread[]> workers;
+    static thread_local unsigned int worker_count = 0;
+    if (!workers) {
+        worker_count = std::thread::hardware_concurrency();
+        if (worker_count == 0) worker_count = 1;
+        workers.reset(new TaskThread[worker_count]);
+    }
+    unsigned int threads = worker_count;
+    if (threads > ps->segment_count) threads = ps->segment_count;
+
+    ps->next_segment = 0;
+    ps->segments_written = 0;
+    ps->aborted = 0;
+    ps->lookahead = threads * 2;
+
+    for (unsigned int i = 0; i < threads; i++) {
+        task_start(&workers[i], pcm_worker, ps);
+    }
+
+    int failed = 0;
+    for (uint32_t index = 0; index < ps->segment_count && !failed; index++) {
+        PcmSegment* seg = &ps->segments[index];
+        {
+            std::unique_lock<std::mutex> guard(ps->lock);
+            ps->changed.wait(guard, [&] { return seg->done || ps->aborted; });
+            if (!seg->done || !seg->samples) {
+                failed = 1;
+                break;
+            }
+        }
+
+        if (fwrite(seg->samples, 1, seg->bytes, ps->file) != seg->bytes) failed = 1;
+        ps->data_bytes += seg->bytes;
+        free(seg->samples);
+        seg->samples = NULL;
+
+        std::lock_guard<std::mutex> guard(ps->lock);
+        ps->segments_written++;
+        if (failed) ps->aborted = 1;
+        ps->changed.notify_all();
+    }
+
+    if (failed) {
+        std::lock_guard<std::mutex> guard(ps->lock);
+        ps->aborted = 1;
+        ps->changed.notify_all();
+    }
+    for (unsigned int i = 0; i < threads; i++) task_wait(&workers[i]);
+    return failed ? -1 : 0;
+}
+
+static uint32_t pcm_finish(void* state) {
+    PcmSink* ps = (PcmSink*)state;
+    int failed = 0;
+
+    // Trim trailing zero frames
+    uint32_t kept = ps->frame_count;
+    while (kept > 0 && is_zero_frame(ps->frames[kept - 1].regs)) kept--;
+    if (kept < ps->frame_count) {
+        log_printf("Trimmed %u trailing zero frames from output.\n", ps->frame_count - kept);
+    }
+
+    if (kept > 0) {
+        ps->frames_kept = kept;
+        ps->segment_count = (kept + PCM_SEGMENT_FRAMES - 1) / PCM_SEGMENT_FRAMES;
+        ps->segments = (PcmSegment*)arena_alloc(ps->arena, ps->segment_count * sizeof(PcmSegment));
+        if (ps->segments) memset(ps->segments, 0, ps->segment_count * sizeof(PcmSegment));
+        failed = ps->segments ? pcm_write_segments(ps) : -1;
+    }
+
+    if (ps->wav && !failed) {
+        fseek(ps->file, 0, SEEK_SET);
+        failed = write_wav_header(ps);
+    }
+    if (fclose(ps->file) != 0) failed = -1;
+    ps->file = NULL;
+    return failed ? 0 : kept;
+}
+
+static void pcm_release(void* state) {
+    PcmSink* ps = (PcmSink*)state;
+    if (ps->file) fclose(ps->file);
+    aysynth_free(&ps->synth);
+    for (uint32_t i = 0; ps->segments && i < ps->segment_count; i++) {
+        free(ps->segments[i].samples);
+    }
+    ps->~PcmSink();
+}
+
+static void* pcm_open(const char* path, const SongInfo* info, int wav, Arena* arena) {
+    void* memory = arena_alloc(arena, sizeof(PcmSink));
+    if (!memory) return NULL;
+    PcmSink* ps = new (memory) PcmSink();
+
+    ps->arena = arena;
+    ps->wav = wav;
+    ps->info = *info;
+    if (aysynth_init(&ps->synth, info->ay_clock, info->cpu_clock, info->frame_tstates, &info->pcm) != 0) {
+        printf("Can't set up the synthesiser at %u Hz\n", info->pcm.sample_rate);
+        ps->~PcmSink();
+        return NULL;
+    }
+    ps->frame_capacity = info->frame_budget ? info->frame_budget : 4096;
+    ps->frames = (FrameRecord*)arena_alloc(arena, ps->frame_capacity * sizeof(FrameRecord));
+    ps->checkpoint_capacity = ps->frame_capacity / PCM_SEGMENT_FRAMES + 1;
+    ps->checkpoints = (AySynthState*)arena_alloc(arena, ps->checkpoint_capacity * sizeof(AySynthState));
+    ps->file = fopen(path, "wb");
+    if (!ps->file || !ps->frames || !ps->checkpoints) {
+        printf("Can't open output file '%s'\n", path);
+        pcm_release(ps);
+        return NULL;
+    }
+
+    // Header is rewritten with the final sizes on finish
+    if (wav && write_wav_header(ps) != 0) {
+        pcm_release(ps);
+        return NULL;
+    }
+    return ps;
+}
+
+//
+// Sink set
+//
+
+static int sink_open(FrameSink* sink, OutputFormat format, const char* path, const SongInfo* info, Arena* arena) {
+    sink->format = format;
+    sink->path = path;
+    sink->failed = 0;
+    sink->frames_kept = 0;
+
+    // The ring first, so the sink's growing buffer is the arena's last block
+    FrameRecord* slots = (FrameRecord*)arena_alloc(arena, SINK_RING_FRAMES * sizeof(FrameRecord));
+    if (!slots) return -1;
+    framering_init(&sink->ring, slots, SINK_RING_FRAMES);
+
+    switch (format) {
+    case OUTPUT_YM:
+    case OUTPUT_YM_LHA:
+        sink->state = ym_open(path, info, format == OUTPUT_YM_LHA, arena);
+        sink->frame = ym_frame;
+        sink->finish = ym_finish;
+        sink->release = ym_release;
+        break;
+    case OUTPUT_VGM:
+    case OUTPUT_PSG:
+        sink->state = stream_open(path, info, format == OUTPUT_PSG ? STREAM_PSG : STREAM_VGM, arena);
+        sink->frame = stream_frame;
+        sink->finish = stream_finish;
+        sink->release = stream_release;
+        break;
+    case OUTPUT_WAV:
+    case OUTPUT_PCM:
+        sink->state = pcm_open(path, info, format == OUTPUT_WAV, arena);
+        sink->frame = pcm_frame;
+        sink->finish = pcm_finish;
+        sink->release = pcm_release;
+        break;
+    case OUTPUT_REGS:
+    default:
+        sink->state = regs_open(path, arena);
+        sink->frame = regs_frame;
+        sink->finish = regs_finish;
+        sink->release = regs_release;
+        break;
+    }
+
+    return sink->state ? 0 : -1;
+}
+
+int sinkset_open(SinkSet* set, const OutputFormat* formats, char* const* paths,
+    int count, const SongInfo* info, Arena* arenas)
+{
+    // An output that can't be opened is left out; the song's other formats
+    // are still written
+    set->count = 0;
+    set->started = 0;
+    for (int i = 0; i < count && i < MAX_OUTPUTS; i++) {
+        arena_reset(&arenas[i]);
+        if (sink_open(&set->sinks[set->count], formats[i], paths[i], info, &arenas[i]) == 0) {
+            set->count++;
+        }
+    }
+    return set->count > 0 || count == 0 ? 0 : -1;
+}
+
+static void sink_thread(void* arg) {
+    FrameSink* sink = (FrameSink*)arg;
+    log_quiet = sink->quiet;
+    FrameRecord record;
+    while (framering_pop(&sink->ring, &record)) {
+        // Keep draining after a failure so the emulator never blocks
+        if (!sink->failed && sink->frame(sink->state, &record) != 0) {
+            printf("Write error on '%s'\n", sink->path);
+            sink->failed = 1;
+        }
+    }
+    sink->frames_kept = sink->finish(sink->state);
+}
+
+// The sink threads of the emulation thread
+static thread_local TaskThread sink_threads[MAX_OUTPUTS];
+
+void sinkset_start(SinkSet* set) {
+    for (int i = 0; i < set->count; i++) {
+        set->sinks[i].quiet = log_quiet;
+        task_start(&sink_threads[i], sink_thread, &set->sinks[i]);
+    }
+    set->started = 1;
+}
+
+void sinkset_push(SinkSet* set, const uint8_t regs[16], int env_written) {
+    FrameRecord record;
+    memcpy(record.regs, regs, 16);
+    record.env_written = (uint8_t)env_written;
+
+    for (int i = 0; i < set->count; i++) {
+        framering_push(&set->sinks[i].ring, &record);
+    }
+}
+
+int sinkset_finish(SinkSet* set) {
+    int kept = 0;
+
+    for (int i = 0; i < set->count; i++) {
+        framering_close(&set->sinks[i].ring);
+    }
+
+    for (int i = 0; i < set->count; i++) {
+        FrameSink* sink = &set->sinks[i];
+        if (set->started) task_wait(&sink_threads[i]);
+
+        if (sink->failed || sink->frames_kept == 0) {
+            if (remove(sink->path) != 0) {
+                printf("Warning: Failed to delete output file '%s'\n", sink->path);
+            }
+        }
+        else {
+            kept++;
+        }
+
+        sink->release(sink->state);
+        sink->state = NULL;
+    }
+
+    set->count = 0;
+    set->started = 0;
+    return kept;
+}
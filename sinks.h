@@ -0,0 +1,89 @@
+/* sinks.h
+ * Output sinks fed from the emulated frame stream.
+ *
+ * Every requested format gets its own sink running on its own thread. The
+ * emulator pushes each frame into one lock-free ring per sink, so a song is
+ * emulated exactly once no matter how many formats are written. The sink
+ * threads (and the audio render threads) belong to the emulating thread and
+ * are kept for its next song rather than started for each one.
+ */
+
+#ifndef __SINKS_INCLUDED__
+#define __SINKS_INCLUDED__
+
+#include "arena.h"
+#include "aysynth.h"
+#include "framering.h"
+#include <stdint.h>
+
+#define MAX_OUTPUTS 8
+#define SINK_RING_FRAMES 4096
+
+typedef enum {
+    OUTPUT_YM = 0,      // YM6, uncompressed
+    OUTPUT_YM_LHA,      // YM6 packed with LHA -lh5-, as usually distributed
+    OUTPUT_VGM,         // VGM with AY8910 commands, changes only
+    OUTPUT_PSG,         // ZX PSG, changes only
+    OUTPUT_REGS,        // raw dump, 16 registers per frame
+    OUTPUT_WAV,         // synthesised audio, 16-bit WAV
+    OUTPUT_PCM,         // synthesised audio, raw 16-bit little endian
+    OUTPUT_FORMAT_COUNT
+} OutputFormat;
+
+// Song metadata shared by all sinks of a song
+typedef struct SongInfo {
+    const char* title;
+    const char* author;
+    uint32_t ay_clock;
+    uint32_t frame_rate;      // Hz, rounded
+    uint32_t cpu_clock;       // the exact frame period: frame_tstates cycles at cpu_clock
+    uint32_t frame_tstates;
+    uint32_t frame_budget;    // most frames the song can produce, 0 if unknown
+    PcmSettings pcm;          // used by the audio sinks
+} SongInfo;
+
+typedef struct FrameSink {
+    OutputFormat format;
+    const char* path;
+    void* state;
+    int (*frame)(void* state, const FrameRecord* record);
+    uint32_t (*finish)(void* state);    // frames kept, the file is deleted if 0
+    void (*release)(void* state);
+
+    FrameRing ring;
+    int quiet;                // progress output off, as on the emulating thread
+    int failed;
+    uint32_t frames_kept;
+} FrameSink;
+
+typedef struct SinkSet {
+    FrameSink sinks[MAX_OUTPUTS];
+    int count;
+    int started;              // sinkset_start has handed the sinks to their threads
+} SinkSet;
+
+// Format name as given on the command line, and output file extension
+const char* output_format_name(OutputFormat format);
+const char* output_format_extension(OutputFormat format);
+int output_format_from_name(const char* name, OutputFormat* format);
+
+// Open one sink per format. paths[i] is the output file for formats[i].
+// Everything the sink for formats[i] allocates comes from arenas[i], which
+// is reset here and must stay with the sink until sinkset_finish. Outputs
+// that can't be created are skipped. Returns 0 if at least one output is
+// open, -1 if none could be created.
+int sinkset_open(SinkSet* set, const OutputFormat* formats, char* const* paths,
+    int count, const SongInfo* info, Arena* arenas);
+
+// Start the sinks on the calling thread's sink threads, which are created
+// by its first song. sinkset_finish must be called from the same thread.
+void sinkset_start(SinkSet* set);
+
+// Hand one frame to every sink (called from the emulation thread)
+void sinkset_push(SinkSet* set, const uint8_t regs[16], int env_written);
+
+// Wait for all sinks to drain, finish their files and delete empty ones.
+// Returns the number of outputs that were kept.
+int sinkset_finish(SinkSet* set);
+
+#endif
@@ -0,0 +1,150 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "snapshot.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Header, CPU, AY/IO state, position, then the 64KB memory image and the frames
+#define SNAPSHOT_HEADER_SIZE 16
+#define SNAPSHOT_CPU_SIZE (4 * 8 + 7 * 2 + 4 * 2)
+#define SNAPSHOT_IO_SIZE 28
+#define SNAPSHOT_POSITION_SIZE 20
+#define SNAPSHOT_FIXED_SIZE (SNAPSHOT_HEADER_SIZE + SNAPSHOT_CPU_SIZE + SNAPSHOT_IO_SIZE + \
+    SNAPSHOT_POSITION_SIZE + 0x10000)
+
+uint64_t snapshot_key(const uint8_t* memory, uint16_t stack, uint8_t hi_reg, uint8_t lo_reg,
+    uint64_t cpu_clock, uint32_t frame_tstates, uint32_t frame_rate)
+{
+    uint64_t key = hash64_u32(HASH64_SEED, SNAPSHOT_VERSION);
+    key = hash64_u32(key, stack | (hi_reg << 16) | (lo_reg << 24));
+    key = hash64_u64(key, cpu_clock);
+    key = hash64_u32(key, frame_tstates);
+    key = hash64_u32(key, frame_rate);
+    return hash64(key, memory, 0x10000);
+}
+
+// The register decoding tables in Z80_STATE point into the structure itself,
+// so only the register values are stored
+static uint8_t* put_cpu(uint8_t* out, const Z80_STATE* cpu) {
+    const int values[8] = { cpu->status, cpu->halted, cpu->i, cpu->r, cpu->pc, cpu->iff1, cpu->iff2, cpu->im };
+    for (int i = 0; i < 8; i++, out += 4) cache_put_u32(out, (uint32_t)values[i]);
+    for (int i = 0; i < 7; i++, out += 2) {
+        out[0] = cpu->registers.word[i] & 0xFF;
+        out[1] = cpu->registers.word[i] >> 8;
+    }
+    for (int i = 0; i < 4; i++, out += 2) {
+        out[0] = cpu->alternates[i] & 0xFF;
+        out[1] = cpu->alternates[i] >> 8;
+    }
+    return out;
+}
+
+static const uint8_t* get_cpu(const uint8_t* in, Z80_STATE* cpu) {
+    int* const values[8] = { &cpu->status, &cpu->halted, &cpu->i, &cpu->r, &cpu->pc, &cpu->iff1, &cpu->iff2, &cpu->im };
+    Z80Reset(cpu);
+    for (int i = 0; i < 8; i++, in += 4) *values[i] = (int)cache_get_u32(in);
+    for (int i = 0; i < 7; i++, in += 2) cpu->registers.word[i] = (unsigned short)(in[0] | (in[1] << 8));
+    for (int i = 0; i < 4; i++, in += 2) cpu->alternates[i] = (unsigned short)(in[0] | (in[1] << 8));
+    return in;
+}
+
+static uint8_t* put_io(uint8_t* out, const AY2YM* ctx) {
+    memset(out, 0, SNAPSHOT_IO_SIZE);
+    memcpy(out, ctx->ay_regs, 16);
+    out[16] = ctx->ay_reg_select;
+    out[17] = ctx->beeper;
+    out[18] = ctx->is_done;
+    out[19] = ctx->addr_latch;
+    out[20] = ctx->env_written;
+    out[21] = ctx->CPCData;
+    out[22] = ctx->CPCSwitch;
+    out[24] = ctx->spectrum_regs & 0xFF;
+    out[25] = ctx->spectrum_regs >> 8;
+    out[26] = ctx->cpc_regs & 0xFF;
+    out[27] = ctx->cpc_regs >> 8;
+    return out + SNAPSHOT_IO_SIZE;
+}
+
+static const uint8_t* get_io(const uint8_t* in, AY2YM* ctx) {
+    memcpy(ctx->ay_regs, in, 16);
+    ctx->ay_reg_select = in[16];
+    ctx->beeper = in[17];
+    ctx->is_done = in[18];
+    ctx->addr_latch = in[19];
+    ctx->env_written = in[20];
+    ctx->CPCData = in[21];
+    ctx->CPCSwitch = in[22];
+    ctx->spectrum_regs = (uint16_t)(in[24] | (in[25] << 8));
+    ctx->cpc_regs = (uint16_t)(in[26] | (in[27] << 8));
+    return in + SNAPSHOT_IO_SIZE;
+}
+
+int snapshot_load(const char* dir, uint64_t key, Z80_STATE* cpu, AY2YM* ctx,
+    EmulationPosition* position, FrameLog* frames)
+{
+    uint8_t* data;
+    size_t size;
+    if (cache_read_entry(dir, key, "ays", &data, &size) != 0) return -1;
+
+    const uint8_t* in = data;
+    uint32_t count = size >= SNAPSHOT_FIXED_SIZE
+        ? cache_get_u32(data + SNAPSHOT_HEADER_SIZE + SNAPSHOT_CPU_SIZE + SNAPSHOT_IO_SIZE + 16) : 0;
+    if (size < SNAPSHOT_FIXED_SIZE ||
+        memcmp(in, "AYSS", 4) != 0 ||
+        cache_get_u32(in + 4) != SNAPSHOT_VERSION ||
+        cache_get_u64(in + 8) != key ||
+        size != SNAPSHOT_FIXED_SIZE + (size_t)count * sizeof(FrameRecord)) {
+        free(data);
+        return -1;
+    }
+
+    FrameLog log = {};
+    in += SNAPSHOT_FIXED_SIZE;
+    for (uint32_t i = 0; i < count; i++, in += sizeof(FrameRecord)) {
+        if (framelog_append(&log, in, in[16]) != 0) {
+            framelog_free(&log);
+            free(data);
+            return -1;
+        }
+    }
+
+    in = get_cpu(data + SNAPSHOT_HEADER_SIZE, cpu);
+    in = get_io(in, ctx);
+    position->cycles = cache_get_u64(in);
+    position->next_frame = cache_get_u64(in + 8);
+    position->frames = count;
+    memcpy(ctx->memory, in + SNAPSHOT_POSITION_SIZE, 0x10000);
+
+    log.machine = frames->machine;
+    framelog_free(frames);
+    *frames = log;
+    free(data);
+    return 0;
+}
+
+int snapshot_store(const char* dir, uint64_t key, const Z80_STATE* cpu, const AY2YM* ctx,
+    const EmulationPosition* position, const FrameLog* frames)
+{
+    size_t size = SNAPSHOT_FIXED_SIZE + (size_t)position->frames * sizeof(FrameRecord);
+    uint8_t* data = (uint8_t*)malloc(size);
+    if (!data || frames->count < position->frames) {
+        free(data);
+        return -1;
+    }
+
+    memcpy(data, "AYSS", 4);
+    cache_put_u32(data + 4, SNAPSHOT_VERSION);
+    cache_put_u64(data + 8, key);
+    uint8_t* out = put_cpu(data + SNAPSHOT_HEADER_SIZE, cpu);
+    out = put_io(out, ctx);
+    cache_put_u64(out, position->cycles);
+    cache_put_u64(out + 8, position->next_frame);
+    cache_put_u32(out + 16, position->frames);
+    memcpy(out + SNAPSHOT_POSITION_SIZE, ctx->memory, 0x10000);
+    memcpy(data + SNAPSHOT_FIXED_SIZE, frames->frames, position->frames * sizeof(FrameRecord));
+
+    int failed = cache_write_entry(dir, key, "ays", data, size);
+    free(data);
+    return failed;
+}
@@ -0,0 +1,35 @@
+/* snapshot.h
+ * Persistent cache of the machine state right after the player's init.
+ *
+ * Some players spend many frames in init unpacking their data. The state
+ * once `call init` in the intz/intnz stub has returned (CPU, memory, AY
+ * latch state, the registers written through each port protocol, emulation
+ * position and the frames produced so far) is
+ * stored under a key hashed from the loaded memory image, the start
+ * registers and the machine's timing, and later runs resume from it.
+ */
+
+#ifndef __SNAPSHOT_INCLUDED__
+#define __SNAPSHOT_INCLUDED__
+
+#include "ay2ym.h"
+#include "framecache.h"
+
+// Bump whenever a change to the emulation changes what init leaves behind
+#define SNAPSHOT_VERSION 2
+
+// memory holds the image with the stub in place, before any code has run
+uint64_t snapshot_key(const uint8_t* memory, uint16_t stack, uint8_t hi_reg, uint8_t lo_reg,
+    uint64_t cpu_clock, uint32_t frame_tstates, uint32_t frame_rate);
+
+// Returns 0 and restores cpu, ctx, position and the init frames on a hit,
+// -1 on a miss or a damaged entry (nothing is changed then)
+int snapshot_load(const char* dir, uint64_t key, Z80_STATE* cpu, AY2YM* ctx,
+    EmulationPosition* position, FrameLog* frames);
+
+// frames holds the first position->frames frames of the song.
+// Returns 0 on success, -1 on failure.
+int snapshot_store(const char* dir, uint64_t key, const Z80_STATE* cpu, const AY2YM* ctx,
+    const EmulationPosition* position, const FrameLog* frames);
+
+#endif
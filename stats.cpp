@@ -0,0 +1,104 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "stats.h"
+#include "serialize.h"
+#include <algorithm>
+
+double stats_mhz(const SongStats* stats) {
+    if (stats->wall_seconds <= 0) return 0;
+    return (double)stats->cycles / stats->wall_seconds / 1e6;
+}
+
+double stats_realtime_factor(const SongStats* stats) {
+    if (stats->wall_seconds <= 0) return 0;
+    return stats->play_seconds / stats->wall_seconds;
+}
+
+static void sort_songs(std::vector<SongStats>* songs) {
+    std::sort(songs->begin(), songs->end(), [](const SongStats& a, const SongStats& b) {
+        if (a.source != b.source) return a.source < b.source;
+        return a.song < b.song;
+    });
+}
+
+// Sum of all songs; wall_seconds is the CPU-side time spent on songs
+static SongStats total_of(const std::vector<SongStats>& songs) {
+    SongStats total = SongStats();
+    for (size_t i = 0; i < songs.size(); i++) {
+        const SongStats& s = songs[i];
+        total.cached += s.cached;
+        total.frames += s.frames;
+        total.play_seconds += s.play_seconds;
+        total.cycles += s.cycles;
+        total.instructions += s.instructions;
+        total.interrupts += s.interrupts;
+        total.ay_writes += s.ay_writes;
+        total.bytes_written += s.bytes_written;
+        total.wall_seconds += s.wall_seconds;
+    }
+    return total;
+}
+
+void stats_print(FILE* out, std::vector<SongStats> songs, double run_seconds) {
+    sort_songs(&songs);
+    for (size_t i = 0; i < songs.size(); i++) {
+        const SongStats& s = songs[i];
+        fprintf(out, "%s #%d: %u frames%s, %llu cycles, %llu instructions, %u interrupts, %llu AY writes, "
+            "%.1f ms, %.1f MHz, %.0fx realtime, %llu bytes\n",
+            s.source.c_str(), s.song, s.frames, s.cached ? " (cached)" : "",
+            (unsigned long long)s.cycles, (unsigned long long)s.instructions, s.interrupts,
+            (unsigned long long)s.ay_writes, s.wall_seconds * 1000, stats_mhz(&s),
+            stats_realtime_factor(&s), (unsigned long long)s.bytes_written);
+    }
+
+    SongStats total = total_of(songs);
+    fprintf(out, "Total: %zu songs (%d cached), %u frames, %llu cycles, %llu instructions, %u interrupts, "
+        "%llu AY writes, %llu bytes\n",
+        songs.size(), total.cached, total.frames, (unsigned long long)total.cycles,
+        (unsigned long long)total.instructions, total.interrupts, (unsigned long long)total.ay_writes,
+        (unsigned long long)total.bytes_written);
+    fprintf(out, "Total: %.3f s song time, %.3f s CPU time over songs, %.3f s wall time, %.1f MHz per song, "
+        "%.0fx realtime overall\n",
+        total.play_seconds, total.wall_seconds, run_seconds, stats_mhz(&total),
+        run_seconds > 0 ? total.play_seconds / run_seconds : 0.0);
+}
+
+static void json_counters(FILE* out, const SongStats& s) {
+    fprintf(out, "\"frames\":%u,\"play_seconds\":%.6f,\"cycles\":%llu,\"instructions\":%llu,\"interrupts\":%u,"
+        "\"ay_writes\":%llu,\"bytes_written\":%llu,\"wall_seconds\":%.6f,\"mhz\":%.3f,\"realtime_factor\":%.3f",
+        s.frames, s.play_seconds, (unsigned long long)s.cycles, (unsigned long long)s.instructions, s.interrupts,
+        (unsigned long long)s.ay_writes, (unsigned long long)s.bytes_written, s.wall_seconds,
+        stats_mhz(&s), stats_realtime_factor(&s));
+}
+
+int stats_write_json(const char* path, std::vector<SongStats> songs, double run_seconds) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        printf("Can't open stats file '%s'\n", path);
+        return -1;
+    }
+
+    sort_songs(&songs);
+    fprintf(out, "{\"songs\":[");
+    for (size_t i = 0; i < songs.size(); i++) {
+        const SongStats& s = songs[i];
+        fprintf(out, "%s\n{\"source\":", i ? "," : "");
+        json_string(out, s.source);
+        fprintf(out, ",\"song\":%d,\"name\":", s.song);
+        json_string(out, s.name);
+        fprintf(out, ",\"cached\":%s,\"cpu_clock\":%llu,", s.cached ? "true" : "false",
+            (unsigned long long)s.cpu_clock);
+        json_counters(out, s);
+        fprintf(out, "}");
+    }
+
+    SongStats total = total_of(songs);
+    fprintf(out, "\n],\n\"total\":{\"songs\":%zu,\"cached\":%d,\"run_wall_seconds\":%.6f,", songs.size(),
+        total.cached, run_seconds);
+    json_counters(out, total);
+    fprintf(out, "}}\n");
+
+    int failed = ferror(out) != 0;
+    if (fclose(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,43 @@
+/* stats.h
+ * Per-song and per-run performance statistics (--stats, --stats-json).
+ *
+ * The counters are kept by the emulation itself (AY2YM context and the
+ * emulation loop); this module only turns them into reports.
+ */
+
+#ifndef __STATS_INCLUDED__
+#define __STATS_INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+typedef struct SongStats {
+    std::string source;       // AY file
+    int song;
+    std::string name;
+    int cached;               // frames came from the frame cache
+    uint32_t frames;          // frames written to the sinks
+    double play_seconds;      // how long they play, at the song's machine frame rate
+    uint64_t cycles;          // CPU cycles emulated in this run
+    uint64_t instructions;    // Z80 instructions executed
+    uint32_t interrupts;      // interrupts accepted
+    uint64_t ay_writes;       // AY register writes
+    uint64_t cpu_clock;       // Hz, 0 if nothing was emulated
+    uint64_t bytes_written;   // all outputs of the song
+    double wall_seconds;      // from parsing the song to its outputs being closed
+} SongStats;
+
+// Emulated speed in MHz and song time over wall time, 0 if unknown
+double stats_mhz(const SongStats* stats);
+double stats_realtime_factor(const SongStats* stats);
+
+// One line per song and a total, sorted by source and song. run_seconds is
+// the wall time of the whole run (songs may have run in parallel).
+void stats_print(FILE* out, std::vector<SongStats> songs, double run_seconds);
+
+// Returns 0 on success, -1 on failure
+int stats_write_json(const char* path, std::vector<SongStats> songs, double run_seconds);
+
+#endif
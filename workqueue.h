@@ -0,0 +1,137 @@
+/* workqueue.h
+ * Bounded lock-free multi-producer multi-consumer queue of pointers, the
+ * link between the stages of the batch pipeline.
+ *
+ * Each slot carries a sequence number that tells producers and consumers
+ * whose turn it is (D. Vyukov's bounded queue), so no thread ever holds a
+ * lock. A full queue makes producers wait, which is what keeps a fast stage
+ * from running ahead of a slow one; waiting threads sleep on the queue's
+ * RingWaiter (framering.h).
+ */
+
+#ifndef __WORKQUEUE_INCLUDED__
+#define __WORKQUEUE_INCLUDED__
+
+#include "framering.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+typedef struct WorkSlot {
+    std::atomic<size_t> sequence;
+    void* item;
+} WorkSlot;
+
+typedef struct WorkQueue {
+    alignas(64) std::atomic<size_t> head;   // next slot to fill
+    alignas(64) std::atomic<size_t> tail;   // next slot to take
+    alignas(64) std::atomic<int> closed;    // all producers are done
+    WorkSlot* slots;
+    size_t mask;
+    RingWaiter waiter;
+} WorkQueue;
+
+// Capacity must be a power of two. Returns 0 on success, -1 on allocation failure.
+static inline int workqueue_init(WorkQueue* queue, size_t capacity) {
+    queue->slots = new (std::nothrow) WorkSlot[capacity];
+    if (!queue->slots) return -1;
+    for (size_t i = 0; i < capacity; i++) queue->slots[i].sequence.store(i, std::memory_order_relaxed);
+    queue->mask = capacity - 1;
+    queue->head.store(0, std::memory_order_relaxed);
+    queue->tail.store(0, std::memory_order_relaxed);
+    queue->closed.store(0, std::memory_order_relaxed);
+    queue->waiter.sleepers.store(0, std::memory_order_relaxed);
+    return 0;
+}
+
+static inline void workqueue_free(WorkQueue* queue) {
+    delete[] queue->slots;
+    queue->slots = NULL;
+}
+
+// Returns 1 if the item was queued, 0 if the queue is full
+static inline int workqueue_try_push(WorkQueue* queue, void* item) {
+    size_t head = queue->head.load(std::memory_order_relaxed);
+    for (;;) {
+        WorkSlot* slot = &queue->slots[head & queue->mask];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)head;
+        if (diff == 0) {
+            if (queue->head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                slot->item = item;
+                slot->sequence.store(head + 1, std::memory_order_release);
+                return 1;
+            }
+        }
+        else if (diff < 0) {
+            return 0;
+        }
+        else {
+            head = queue->head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Returns 1 and the item, or 0 if the queue is empty
+static inline int workqueue_try_pop(WorkQueue* queue, void** item) {
+    size_t tail = queue->tail.load(std::memory_order_relaxed);
+    for (;;) {
+        WorkSlot* slot = &queue->slots[tail & queue->mask];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(tail + 1);
+        if (diff == 0) {
+            if (queue->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                *item = slot->item;
+                slot->sequence.store(tail + queue->mask + 1, std::memory_order_release);
+                return 1;
+            }
+        }
+        else if (diff < 0) {
+            return 0;
+        }
+        else {
+            tail = queue->tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Blocks while the queue is full
+static inline void workqueue_push(WorkQueue* queue, void* item) {
+    unsigned spins = 0;
+    for (;;) {
+        size_t tail = queue->tail.load(std::memory_order_acquire);
+        if (workqueue_try_push(queue, item)) break;
+        ringwaiter_wait(&queue->waiter, &spins,
+            [&] { return queue->tail.load(std::memory_order_acquire) != tail; });
+    }
+    ringwaiter_notify(&queue->waiter);
+}
+
+// Called once every producer has pushed its last item
+static inline void workqueue_close(WorkQueue* queue) {
+    queue->closed.store(1, std::memory_order_release);
+    ringwaiter_notify(&queue->waiter);
+}
+
+// Blocks until an item is available. Returns 0 once the queue is closed
+// and empty.
+static inline int workqueue_pop(WorkQueue* queue, void** item) {
+    unsigned spins = 0;
+    for (;;) {
+        size_t head = queue->head.load(std::memory_order_acquire);
+        if (workqueue_try_pop(queue, item)) break;
+        if (queue->closed.load(std::memory_order_acquire)) {
+            // Pushes made before the close are visible now
+            if (!workqueue_try_pop(queue, item)) return 0;
+            break;
+        }
+        ringwaiter_wait(&queue->waiter, &spins, [&] {
+            return queue->head.load(std::memory_order_acquire) != head || queue->closed.load(std::memory_order_acquire);
+        });
+    }
+    ringwaiter_notify(&queue->waiter);
+    return 1;
+}
+
+#endif
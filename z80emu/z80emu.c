@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
 
 #include "z80emu.h"
 #include "z80user.h"
@@ -279,6 +280,10 @@ static int emulate(Z80_STATE* state,
 
 	start_emulation:
 
+#ifdef Z80_INSTRUCTION_HOOK
+		Z80_INSTRUCTION_HOOK(pc - 1, elapsed_cycles);
+#endif
+
 		registers = state->register_table;
 
 	emulate_next_opcode:
@@ -633,6 +638,58 @@ static int emulate(Z80_STATE* state,
 
 			r -= 2;
 			elapsed_cycles -= 8;
+
+#if defined(Z80_MEMORY) && !defined(Z80_HANDLE_SELF_MODIFYING_CODE)
+
+			/* The iterations that fit in the cycle budget as one copy, when
+			 * source and destination neither overlap nor wrap around.
+			 * Registers, R, flags and cycles end up as the loop below
+			 * leaves them.
+			 */
+			{
+				int     count, done, src, dst;
+
+				count = number_cycles - elapsed_cycles <= 21
+					? 1
+					: (number_cycles - elapsed_cycles + 20) / 21;
+				done = bc != 0 && bc <= count;
+				if (done)
+
+					count = bc;
+
+				src = d > 0 ? hl : hl - count + 1;
+				dst = d > 0 ? de : de - count + 1;
+				if (count > 1
+					&& src >= 0 && src + count <= 0x10000
+					&& dst >= 0 && dst + count <= 0x10000
+					&& (src - dst >= count || dst - src >= count)) {
+
+					memcpy(&Z80_MEMORY[dst], &Z80_MEMORY[src], count);
+					n = Z80_MEMORY[d > 0 ? dst + count - 1 : dst];
+
+					r += 2 * count;
+					hl += d * count;
+					de += d * count;
+					if (done) {
+
+						bc = 0;
+						elapsed_cycles += 21 * (count - 1) + 16;
+
+					} else {
+
+						bc -= count;
+						elapsed_cycles += 21 * count;
+						f |= Z80_P_FLAG;
+						pc -= 2;
+
+					}
+					goto ldir_lddr_done;
+
+				}
+			}
+
+#endif
+
 			for (; ; ) {
 
 				r += 2;
@@ -681,6 +738,12 @@ static int emulate(Z80_STATE* state,
 
 			}
 
+#if defined(Z80_MEMORY) && !defined(Z80_HANDLE_SELF_MODIFYING_CODE)
+
+		ldir_lddr_done:
+
+#endif
+
 			HL = hl;
 			DE = de;
 			BC = bc;
@@ -2448,6 +2511,54 @@ static int emulate(Z80_STATE* state,
 
 			r -= 2;
 			elapsed_cycles -= 8;
+
+#if defined(Z80_MEMORY) && defined(Z80_OUTPUT_BLOCK)
+
+			/* The iterations that fit in the cycle budget as one block
+			 * write, when the bytes don't wrap around memory. Like the
+			 * loop below, every byte goes to the port B had on entry.
+			 */
+			if (b != 0) {
+
+				int     count, done, first;
+
+				count = number_cycles - elapsed_cycles <= 21
+					? 1
+					: (number_cycles - elapsed_cycles + 20) / 21;
+				done = b <= count;
+				if (done)
+
+					count = b;
+
+				first = d > 0 ? hl : hl - count + 1;
+				if (count > 1 && first >= 0 && first + count <= 0x10000) {
+
+					Z80_OUTPUT_BLOCK(C, hl, count, d);
+					x = Z80_MEMORY[hl + d * (count - 1)];
+
+					r += 2 * count;
+					hl += d * count;
+					b -= count;
+					if (done) {
+
+						f = Z80_Z_FLAG;
+						elapsed_cycles += 21 * (count - 1) + 16;
+
+					} else {
+
+						f = SZYX_FLAGS_TABLE[b];
+						elapsed_cycles += 21 * count;
+						pc -= 2;
+
+					}
+					goto otir_otdr_done;
+
+				}
+
+			}
+
+#endif
+
 			for (; ; ) {
 
 				r += 2;
@@ -2482,6 +2593,12 @@ static int emulate(Z80_STATE* state,
 
 			}
 
+#if defined(Z80_MEMORY) && defined(Z80_OUTPUT_BLOCK)
+
+		otir_otdr_done:
+
+#endif
+
 			HL = hl;
 			B = b;
 
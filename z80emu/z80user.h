@@ -50,6 +50,30 @@ extern "C" {
 
 #define Z80_WRITE_WORD_INTERRUPT(address, x)  Z80_WRITE_WORD((address), (x))
 
+/* Memory as one flat 64K array. With it defined, LDIR/LDDR copy what fits
+ * in the cycle budget in one go, and OTIR/OTDR hand it to Z80_OUTPUT_BLOCK.
+ */
+#define Z80_MEMORY      (((AY2YM *) context)->memory)
+
+/* Called before each instruction with the address of its first opcode and
+ * the cycles elapsed so far in this Z80Emulate() call.
+ */
+#ifdef AY2YM_PROFILE
+#define Z80_INSTRUCTION_HOOK(address, cycles)                          \
+{                                                                       \
+    AY2YM *ay2ym = (AY2YM *) context;                                   \
+    ay2ym->instructions++;                                              \
+    if (ay2ym->profiler)                                                \
+        profiler_instruction(ay2ym->profiler, state, ay2ym->memory,     \
+            (address), (cycles));                                       \
+}
+#else
+#define Z80_INSTRUCTION_HOOK(address, cycles)                          \
+{                                                                       \
+    ((AY2YM *) context)->instructions++;                                \
+}
+#endif
+
 /* Input/output macros */
 #define Z80_INPUT_BYTE(port, x)                                         \
 {                                                                       \
@@ -63,6 +87,16 @@ extern "C" {
     ay2ym_out(context, full_port, (uint8_t)(x), elapsed_cycles);        \
 }
 
+/* count bytes from Z80_MEMORY[address] on, address moving by step (+1 or -1),
+ * written to one port. The run never wraps around memory.
+ */
+#define Z80_OUTPUT_BLOCK(port, address, count, step)                    \
+{                                                                       \
+    uint16_t full_port = ((state->registers.byte[Z80_B] << 8) | (port));\
+    ay2ym_out_block(context, full_port, &Z80_MEMORY[(address)],         \
+        (count), (step), elapsed_cycles);                               \
+}
+
 #ifdef __cplusplus
 }
 #endif
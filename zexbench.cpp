@@ -0,0 +1,343 @@
+/* zexbench.cpp
+ * Z80 core throughput benchmark.
+ *
+ * Runs the emulator exactly as ay2ym configures it (same z80user.h hooks and
+ * AY2YM context) over small loops that each stress one instruction group,
+ * and optionally over zexdoc/zexall as in z80emu/zextest.c. Every workload
+ * gets warm-up runs, then timed repeats with a steady clock; the report
+ * gives the best and median time, emulated MHz and instructions per second,
+ * as text or JSON, so changes to the core can be compared run against run.
+ * Instructions are counted by the z80user.h hook, so a repeated block
+ * instruction (LDIR, CPIR, ...) counts once however many bytes it moves.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "ay2ym.h"
+#include "z80emu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define BENCH_ORIGIN 0x8000
+#define BENCH_STEP_CYCLES 100000
+#define BENCH_DEFAULT_CYCLES 200000000ULL   // per micro-workload run
+#define ZEX_STEP_CYCLES 80000
+
+typedef struct Workload {
+    const char* name;
+    const char* group;
+    const uint8_t* code;      // endless loop placed at BENCH_ORIGIN
+    size_t size;
+} Workload;
+
+// 8/16-bit arithmetic and logic on registers and immediates
+static const uint8_t alu_code[] = {
+    0x80,                     // add a,b
+    0x88,                     // adc a,b
+    0x91,                     // sub c
+    0x9A,                     // sbc a,d
+    0xA3,                     // and e
+    0xAC,                     // xor h
+    0xB5,                     // or l
+    0xB9,                     // cp c
+    0x3C,                     // inc a
+    0x05,                     // dec b
+    0x27,                     // daa
+    0x2F,                     // cpl
+    0xC6, 0x11,               // add a,11h
+    0xEE, 0x55,               // xor 55h
+    0x09,                     // add hl,bc
+    0xED, 0x52,               // sbc hl,de
+    0x23,                     // inc hl
+    0x1B,                     // dec de
+    0xC3, 0x00, 0x80,         // jp 8000h
+};
+
+// Block moves and searches, 256 bytes each
+static const uint8_t block_code[] = {
+    0x21, 0x00, 0xC0,         // ld hl,C000h
+    0x11, 0x00, 0xD0,         // ld de,D000h
+    0x01, 0x00, 0x01,         // ld bc,0100h
+    0xED, 0xB0,               // ldir
+    0x21, 0xFF, 0xC0,         // ld hl,C0FFh
+    0x11, 0xFF, 0xD1,         // ld de,D1FFh
+    0x01, 0x00, 0x01,         // ld bc,0100h
+    0xED, 0xB8,               // lddr
+    0x21, 0x00, 0xC0,         // ld hl,C000h
+    0x01, 0x00, 0x01,         // ld bc,0100h
+    0x3E, 0x55,               // ld a,55h (not in memory: full scan)
+    0xED, 0xB1,               // cpir
+    0xC3, 0x00, 0x80,         // jp 8000h
+};
+
+// IX/IY indexed loads, arithmetic and read-modify-write
+static const uint8_t indexed_code[] = {
+    0xDD, 0x21, 0x00, 0xC0,   // ld ix,C000h
+    0xFD, 0x21, 0x00, 0xD0,   // ld iy,D000h
+    0xDD, 0x7E, 0x05,         // ld a,(ix+5)
+    0xFD, 0x86, 0x03,         // add a,(iy+3)
+    0xDD, 0x77, 0x07,         // ld (ix+7),a
+    0xFD, 0x36, 0x02, 0xAA,   // ld (iy+2),AAh
+    0xDD, 0x34, 0x01,         // inc (ix+1)
+    0xFD, 0xAE, 0xFE,         // xor (iy-2)
+    0xDD, 0x23,               // inc ix
+    0xFD, 0x2B,               // dec iy
+    0xDD, 0x09,               // add ix,bc
+    0xDD, 0xCB, 0x04, 0x46,   // bit 0,(ix+4)
+    0xC3, 0x00, 0x80,         // jp 8000h
+};
+
+// CB prefixed bit tests, sets, resets, rotates and shifts
+static const uint8_t bit_code[] = {
+    0x21, 0x00, 0xC0,         // ld hl,C000h
+    0xCB, 0x47,               // bit 0,a
+    0xCB, 0xC0,               // set 0,b
+    0xCB, 0x89,               // res 1,c
+    0xCB, 0x12,               // rl d
+    0xCB, 0x3B,               // srl e
+    0xCB, 0x07,               // rlc a
+    0xCB, 0x7E,               // bit 7,(hl)
+    0xCB, 0xC6,               // set 0,(hl)
+    0xCB, 0x1E,               // rr (hl)
+    0xC3, 0x00, 0x80,         // jp 8000h
+};
+
+// AY register writes and port reads, the way players do them
+static const uint8_t io_code[] = {
+    0x01, 0xFD, 0xFF,         // ld bc,FFFDh
+    0x3E, 0x07,               // ld a,7
+    0xED, 0x79,               // out (c),a
+    0x06, 0xBF,               // ld b,BFh
+    0x3E, 0x38,               // ld a,38h
+    0xED, 0x79,               // out (c),a
+    0x06, 0xFF,               // ld b,FFh
+    0xED, 0x78,               // in a,(c)
+    0x3E, 0x00,               // ld a,0
+    0xD3, 0xFE,               // out (FEh),a
+    0xDB, 0xFE,               // in a,(FEh)
+    0xC3, 0x00, 0x80,         // jp 8000h
+};
+
+static const Workload micro_workloads[] = {
+    { "alu", "ALU", alu_code, sizeof(alu_code) },
+    { "block", "block ops", block_code, sizeof(block_code) },
+    { "indexed", "IX/IY indexed", indexed_code, sizeof(indexed_code) },
+    { "bit", "CB bit ops", bit_code, sizeof(bit_code) },
+    { "io", "I/O", io_code, sizeof(io_code) },
+};
+
+typedef struct BenchResult {
+    std::string name;
+    uint64_t cycles;          // per run
+    uint64_t instructions;    // per run
+    double best_seconds;
+    double median_seconds;
+} BenchResult;
+
+static AY2YM ctx;
+static int zex_output = 0;    // echo zexdoc/zexall console output
+
+// The ay2ym.cpp versions aren't linked in: port 0 is the CP/M trap used by
+// zexdoc/zexall (OUT ends the run, IN is a BDOS call), everything else just
+// latches and stores AY registers
+extern "C" void SystemCall(AY2YM* context) {
+    // The emulator finishes its step after the final OUT, don't echo again
+    if (context->is_done) return;
+
+    Z80_STATE* state = &context->state;
+    if (state->registers.byte[Z80_C] == 2) {
+        if (zex_output) printf("%c", state->registers.byte[Z80_E]);
+    }
+    else if (state->registers.byte[Z80_C] == 9) {
+        for (int i = state->registers.word[Z80_DE], c = 0; context->memory[i & 0xFFFF] != '$' && c < 256; i++, c++) {
+            if (zex_output) printf("%c", context->memory[i & 0xFFFF]);
+        }
+    }
+}
+
+extern "C" uint8_t ay2ym_in(void* context, uint16_t port, uint64_t /*elapsed_cycles*/) {
+    AY2YM* ay = (AY2YM*)context;
+    if ((port & 0xFF) == 0x00) SystemCall(ay);
+    if (port == 0xFFFD) return ay->ay_regs[ay->addr_latch];
+    return 0xFF;
+}
+
+extern "C" void ay2ym_out(void* context, uint16_t port, uint8_t value, uint64_t /*elapsed_cycles*/) {
+    AY2YM* ay = (AY2YM*)context;
+    if ((port & 0xFF) == 0x00) ay->is_done = 1;
+    else if (port == 0xFFFD) ay->addr_latch = value & 0x0F;
+    else if (port == 0xBFFD) {
+        ay->ay_regs[ay->addr_latch] = value;
+        ay->ay_writes++;
+    }
+}
+
+extern "C" void ay2ym_out_block(void* context, uint16_t port, const uint8_t* data, int count, int step,
+    uint64_t elapsed_cycles)
+{
+    for (int i = 0; i < count; i++) ay2ym_out(context, port, data[i * step], elapsed_cycles);
+}
+
+static void reset_machine() {
+    memset(&ctx, 0, sizeof(ctx));
+    Z80Reset(&ctx.state);
+}
+
+// One run of a micro-workload for a fixed number of cycles
+static uint64_t run_micro(const Workload* workload, uint64_t cycles) {
+    reset_machine();
+    memcpy(ctx.memory + BENCH_ORIGIN, workload->code, workload->size);
+    ctx.state.pc = BENCH_ORIGIN;
+    ctx.state.registers.word[Z80_SP] = 0xFF00;
+
+    uint64_t done = 0;
+    while (done < cycles) {
+        done += Z80Emulate(&ctx.state, BENCH_STEP_CYCLES, &ctx);
+    }
+    return done;
+}
+
+// One run of a CP/M exerciser image, as zextest.c does it
+static uint64_t run_zex(const std::vector<uint8_t>& image) {
+    reset_machine();
+    memcpy(ctx.memory + 0x100, image.data(), std::min(image.size(), (size_t)0xFF00));
+    ctx.memory[0] = 0xD3;     // out (0),a: end of the run
+    ctx.memory[1] = 0x00;
+    ctx.memory[5] = 0xDB;     // in a,(0): BDOS call
+    ctx.memory[6] = 0x00;
+    ctx.memory[7] = 0xC9;     // ret
+    ctx.state.pc = 0x100;
+
+    uint64_t done = 0;
+    while (!ctx.is_done) {
+        done += Z80Emulate(&ctx.state, ZEX_STEP_CYCLES, &ctx);
+    }
+    return done;
+}
+
+template <typename Run>
+static BenchResult measure(const char* name, int warmup, int repeats, Run run) {
+    BenchResult result;
+    result.name = name;
+    result.cycles = 0;
+    result.instructions = 0;
+
+    for (int i = 0; i < warmup; i++) run();
+
+    std::vector<double> times;
+    for (int i = 0; i < repeats; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        result.cycles = run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        result.instructions = ctx.instructions;
+        times.push_back(elapsed.count());
+    }
+
+    std::sort(times.begin(), times.end());
+    result.best_seconds = times.front();
+    result.median_seconds = times[times.size() / 2];
+    return result;
+}
+
+static int load_image(const std::string& path, std::vector<uint8_t>* image) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        printf("Can't open %s\n", path.c_str());
+        return -1;
+    }
+    uint8_t buffer[4096];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), f)) > 0) image->insert(image->end(), buffer, buffer + got);
+    fclose(f);
+    return 0;
+}
+
+static double mhz(const BenchResult& r) {
+    return (double)r.cycles / r.median_seconds / 1e6;
+}
+
+static double instructions_per_second(const BenchResult& r) {
+    return (double)r.instructions / r.median_seconds;
+}
+
+static void print_results(const std::vector<BenchResult>& results) {
+    printf("%-10s %14s %14s %10s %10s %10s %12s\n",
+        "workload", "cycles", "instructions", "best s", "median s", "MHz", "Minstr/s");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        printf("%-10s %14llu %14llu %10.4f %10.4f %10.1f %12.1f\n", r.name.c_str(),
+            (unsigned long long)r.cycles, (unsigned long long)r.instructions,
+            r.best_seconds, r.median_seconds, mhz(r), instructions_per_second(r) / 1e6);
+    }
+}
+
+static int write_json(const char* path, const std::vector<BenchResult>& results, int warmup, int repeats) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        printf("Can't open '%s'\n", path);
+        return -1;
+    }
+    fprintf(out, "{\"warmup\":%d,\"repeats\":%d,\"workloads\":[", warmup, repeats);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(out, "%s\n{\"name\":\"%s\",\"cycles\":%llu,\"instructions\":%llu,\"best_seconds\":%.6f,"
+            "\"median_seconds\":%.6f,\"mhz\":%.3f,\"instructions_per_second\":%.0f}",
+            i ? "," : "", r.name.c_str(), (unsigned long long)r.cycles, (unsigned long long)r.instructions,
+            r.best_seconds, r.median_seconds, mhz(r), instructions_per_second(r));
+    }
+    fprintf(out, "\n]}\n");
+    int failed = ferror(out) != 0;
+    if (fclose(out) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    int warmup = 1;
+    int repeats = 5;
+    uint64_t cycles = BENCH_DEFAULT_CYCLES;
+    const char* zex_dir = NULL;
+    const char* json_path = NULL;
+    const char* only = NULL;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--warmup") == 0 && arg + 1 < argc) warmup = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--repeat") == 0 && arg + 1 < argc) repeats = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc) cycles = strtoull(argv[++arg], NULL, 10);
+        else if (strcmp(argv[arg], "--zex") == 0 && arg + 1 < argc) zex_dir = argv[++arg];
+        else if (strcmp(argv[arg], "--zex-output") == 0) zex_output = 1;
+        else if (strcmp(argv[arg], "--only") == 0 && arg + 1 < argc) only = argv[++arg];
+        else if (strcmp(argv[arg], "--json") == 0 && arg + 1 < argc) json_path = argv[++arg];
+        else {
+            printf("Usage: %s [--warmup n] [--repeat n] [--cycles n] [--only name] [--zex testfiles_dir [--zex-output]] [--json out.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (warmup < 0) warmup = 0;
+    if (repeats < 1) repeats = 1;
+
+    std::vector<BenchResult> results;
+    for (size_t i = 0; i < sizeof(micro_workloads) / sizeof(micro_workloads[0]); i++) {
+        const Workload* w = &micro_workloads[i];
+        if (only && strcmp(only, w->name) != 0) continue;
+        results.push_back(measure(w->name, warmup, repeats, [w, cycles]() { return run_micro(w, cycles); }));
+    }
+
+    if (zex_dir) {
+        static const char* const zex_names[] = { "zexdoc", "zexall" };
+        for (int i = 0; i < 2; i++) {
+            if (only && strcmp(only, zex_names[i]) != 0) continue;
+            std::vector<uint8_t> image;
+            if (load_image(std::string(zex_dir) + "/" + zex_names[i] + ".com", &image) != 0) return 1;
+            results.push_back(measure(zex_names[i], warmup, repeats, [&image]() { return run_zex(image); }));
+        }
+    }
+
+    print_results(results);
+    if (json_path && write_json(json_path, results, warmup, repeats) != 0) return 1;
+    return 0;
+}